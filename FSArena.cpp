@@ -0,0 +1,115 @@
+#include "FSArena.h"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+// Size and alignment of each block the arena carves allocations from.
+// Larger allocations get a block of their own, rounded up to a multiple.
+const std::size_t ARENA_BLOCK_BYTES = 1 << 20;
+
+FSArena::FSArena()
+	: current(nullptr), next(nullptr), end(nullptr), bytesUsed(0), blockBytes(0),
+	references(1)
+{
+} // end constructor
+
+void* FSArena::allocate(std::size_t bytes, std::size_t alignment)
+{
+	std::size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(next) % alignment)
+		% alignment;
+
+	if (current == nullptr || padding + bytes > static_cast<std::size_t>(end - next))
+	{
+		// Allocations start after the header, so every one lies within the
+		// first ARENA_BLOCK_BYTES of its block
+		std::size_t headerBytes = (sizeof(Block) + alignof(std::max_align_t) - 1)
+			/ alignof(std::max_align_t) * alignof(std::max_align_t);
+		std::size_t needed = headerBytes + alignment + bytes;
+		std::size_t size = std::max(ARENA_BLOCK_BYTES,
+			(needed + ARENA_BLOCK_BYTES - 1) / ARENA_BLOCK_BYTES * ARENA_BLOCK_BYTES);
+		Block* block = static_cast<Block*>(::operator new(size,
+			std::align_val_t(ARENA_BLOCK_BYTES)));
+
+		new (block) Block();
+		block->live.store(1, std::memory_order_relaxed);
+		block->bytes = size;
+		blockBytes.fetch_add(size, std::memory_order_relaxed);
+
+		// The previous block goes once its allocations have
+		if (current != nullptr)
+		{
+			dropBlock(current);
+		}
+
+		current = block;
+		next = reinterpret_cast<char*>(block) + headerBytes;
+		end = reinterpret_cast<char*>(block) + size;
+		padding = (alignment - reinterpret_cast<std::uintptr_t>(next) % alignment)
+			% alignment;
+	}
+
+	void* result = next + padding;
+	next += padding + bytes;
+	current->live.fetch_add(1, std::memory_order_relaxed);
+	bytesUsed.fetch_add(bytes, std::memory_order_relaxed);
+	references.fetch_add(1, std::memory_order_relaxed);
+
+	return result;
+} // end allocate
+
+void FSArena::deallocate(void* pointer, std::size_t bytes)
+{
+	Block* block = reinterpret_cast<Block*>(reinterpret_cast<std::uintptr_t>(pointer)
+		& ~static_cast<std::uintptr_t>(ARENA_BLOCK_BYTES - 1));
+
+	bytesUsed.fetch_sub(bytes, std::memory_order_relaxed);
+	dropBlock(block);
+	release();
+} // end deallocate
+
+void FSArena::seal()
+{
+	if (current != nullptr)
+	{
+		dropBlock(current);
+		current = nullptr;
+	}
+} // end seal
+
+void FSArena::release()
+{
+	if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete this;
+	}
+} // end release
+
+std::size_t FSArena::getBytesUsed() const
+{
+	return bytesUsed.load(std::memory_order_relaxed);
+} // end getBytesUsed
+
+std::size_t FSArena::getBlockBytes() const
+{
+	return blockBytes.load(std::memory_order_relaxed);
+} // end getBlockBytes
+
+bool FSArena::isEmpty() const
+{
+	return references.load(std::memory_order_acquire) == 1;
+} // end isEmpty
+
+void FSArena::dropBlock(Block* block)
+{
+	if (block->live.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		blockBytes.fetch_sub(block->bytes, std::memory_order_relaxed);
+		block->~Block();
+		::operator delete(block, std::align_val_t(ARENA_BLOCK_BYTES));
+	}
+} // end dropBlock
+
+FSArena::~FSArena()
+{
+	seal();
+} // end destructor
@@ -0,0 +1,130 @@
+#ifndef FSARENA
+#define FSARENA
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/*
+* FSArena hands out memory from large blocks in allocation order, so nodes
+* allocated one after another during FilesystemTree::compact() end up next
+* to each other. Freed memory is not reused, but each block counts its live
+* allocations and is returned as soon as the last one is freed and the
+* arena has moved on to a newer block or been sealed. A few surviving
+* nodes therefore keep only their own blocks.
+*
+* The arena counts its live allocations plus one reference for its owner.
+* It deletes itself when that count reaches zero. Allocation is not
+* thread-safe; freeing is, because nodes may be dropped by any thread.
+*/
+class FSArena
+{
+public:
+
+	FSArena();
+
+	FSArena(const FSArena&) = delete;
+	FSArena& operator=(const FSArena&) = delete;
+
+	/*
+	* allocate() returns bytes of memory aligned to alignment, and counts one
+	* more live allocation.
+	*/
+	void* allocate(std::size_t bytes, std::size_t alignment);
+
+	/*
+	* deallocate() frees memory from allocate(), given the same byte count,
+	* and drops its reference.
+	*/
+	void deallocate(void* pointer, std::size_t bytes);
+
+	/*
+	* seal() ends allocation from the newest block, so it is returned with
+	* its last allocation like the others. A later allocate() starts a new
+	* block.
+	*/
+	void seal();
+
+	/*
+	* release() drops the owner's reference.
+	*/
+	void release();
+
+	/*
+	* @return Bytes held by live allocations, not counting alignment padding.
+	*/
+	std::size_t getBytesUsed() const;
+
+	/*
+	* @return Bytes of the blocks the arena still holds.
+	*/
+	std::size_t getBlockBytes() const;
+
+	/*
+	* @return True if every allocation has been freed. Only meaningful
+	*         while the owner still holds its reference.
+	*/
+	bool isEmpty() const;
+
+private:
+	~FSArena();
+
+	// Start of every block. Blocks are aligned to ARENA_BLOCK_BYTES, so
+	// masking an allocation's address finds its block.
+	struct Block
+	{
+		std::atomic<std::size_t> live; // allocations, plus one until sealed
+		std::size_t bytes;
+	};
+
+	/*
+	* dropBlock() drops one count of a block, and frees it at zero.
+	*/
+	void dropBlock(Block* block);
+
+	Block* current; // block allocated from, nullptr if none
+	char* next; // next free byte in the newest block
+	char* end; // one past the newest block
+	std::atomic<std::size_t> bytesUsed;
+	std::atomic<std::size_t> blockBytes;
+	std::atomic<std::size_t> references;
+
+}; // end FSArena
+
+/*
+* FSArenaAllocator lets std::allocate_shared place objects (with their
+* control blocks) in an FSArena.
+*/
+template <typename T>
+struct FSArenaAllocator
+{
+	typedef T value_type;
+
+	FSArena* arena;
+
+	FSArenaAllocator(FSArena* pArena) : arena(pArena) {}
+	template <typename U> FSArenaAllocator(const FSArenaAllocator<U>& other)
+		: arena(other.arena) {}
+
+	T* allocate(std::size_t n)
+	{
+		return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, std::size_t n)
+	{
+		arena->deallocate(p, n * sizeof(T));
+	}
+
+	template <typename U> bool operator==(const FSArenaAllocator<U>& other) const
+	{
+		return arena == other.arena;
+	}
+
+	template <typename U> bool operator!=(const FSArenaAllocator<U>& other) const
+	{
+		return arena != other.arena;
+	}
+};
+
+#endif
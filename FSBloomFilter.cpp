@@ -0,0 +1,85 @@
+#include "FSBloomFilter.h"
+#include <bitset>
+#include <cmath>
+
+FSBloomFilter::FSBloomFilter()
+{
+	clear();
+} // end constructor
+
+std::uint64_t FSBloomFilter::hashName(const std::string& pName)
+{
+	// 64-bit FNV-1a
+	std::uint64_t nameHash = 14695981039346656037ULL;
+
+	for (unsigned int i = 0; i < pName.length(); i++)
+	{
+		nameHash ^= static_cast<unsigned char>(pName[i]);
+		nameHash *= 1099511628211ULL;
+	}
+
+	return nameHash;
+} // end hashName
+
+void FSBloomFilter::add(std::uint64_t nameHash)
+{
+	// Double hashing: bit i is (h1 + i * h2) mod BITS
+	std::uint32_t h1 = static_cast<std::uint32_t>(nameHash);
+	std::uint32_t h2 = static_cast<std::uint32_t>(nameHash >> 32) | 1;
+
+	for (int i = 0; i < HASHES; i++)
+	{
+		unsigned int bit = (h1 + i * h2) % BITS;
+		words[bit / 64] |= std::uint64_t(1) << (bit % 64);
+	}
+} // end add
+
+bool FSBloomFilter::mightContain(std::uint64_t nameHash) const
+{
+	std::uint32_t h1 = static_cast<std::uint32_t>(nameHash);
+	std::uint32_t h2 = static_cast<std::uint32_t>(nameHash >> 32) | 1;
+
+	for (int i = 0; i < HASHES; i++)
+	{
+		unsigned int bit = (h1 + i * h2) % BITS;
+		if ((words[bit / 64] & (std::uint64_t(1) << (bit % 64))) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+} // end mightContain
+
+void FSBloomFilter::merge(const FSBloomFilter& other)
+{
+	for (int i = 0; i < BITS / 64; i++)
+	{
+		words[i] |= other.words[i];
+	}
+} // end merge
+
+void FSBloomFilter::clear()
+{
+	for (int i = 0; i < BITS / 64; i++)
+	{
+		words[i] = 0;
+	}
+} // end clear
+
+double FSBloomFilter::fillRatio() const
+{
+	int setBits = 0;
+
+	for (int i = 0; i < BITS / 64; i++)
+	{
+		setBits += std::bitset<64>(words[i]).count();
+	}
+
+	return static_cast<double>(setBits) / BITS;
+} // end fillRatio
+
+double FSBloomFilter::falsePositiveRate() const
+{
+	return std::pow(fillRatio(), HASHES);
+} // end falsePositiveRate
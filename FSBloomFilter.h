@@ -0,0 +1,76 @@
+#ifndef FSBLOOMFILTER
+#define FSBLOOMFILTER
+
+#include <cstdint>
+#include <string>
+
+/*
+* FSBloomFilter is a small fixed-size Bloom filter over names. Each directory
+* keeps one summarizing every name below it, so a search can skip subtrees
+* that certainly do not contain the name it is looking for.
+*
+* Filters only ever answer "maybe" or "no": adding names and merging keep
+* them correct, and a filter that still holds names since removed is merely
+* less selective.
+*
+* The size is fixed so that filters of different directories can be merged.
+* With 256 bits and 3 hashes a filter is useful up to a few hundred names:
+* about 9% false positives at 50 names, 33% at 100 and over 70% at 200.
+* Directories with larger subtrees answer "maybe" for nearly every name, so
+* in a big tree find() prunes in the smaller subtrees near the leaves and
+* simply descends through the levels above them.
+*/
+class FSBloomFilter
+{
+public:
+
+	static constexpr int BITS = 256; // filter size in bits
+	static constexpr int HASHES = 3; // bits set per name
+
+	FSBloomFilter();
+
+	/*
+	* hashName() hashes a name once so the hash can be reused for adds and
+	* lookups across many filters.
+	*/
+	static std::uint64_t hashName(const std::string& pName);
+
+	/*
+	* add() records a name given its hashName().
+	*/
+	void add(std::uint64_t nameHash);
+
+	/*
+	* mightContain() tests a name given its hashName().
+	*
+	* @return false if the name was certainly never added.
+	*/
+	bool mightContain(std::uint64_t nameHash) const;
+
+	/*
+	* merge() adds every name recorded in another filter.
+	*/
+	void merge(const FSBloomFilter& other);
+
+	/*
+	* clear() forgets every name.
+	*/
+	void clear();
+
+	/*
+	* @return Fraction of bits set, from 0 to 1.
+	*/
+	double fillRatio() const;
+
+	/*
+	* @return The chance that mightContain() is true for a name that was
+	*         never added, estimated from the fill ratio.
+	*/
+	double falsePositiveRate() const;
+
+private:
+	std::uint64_t words[BITS / 64];
+
+}; // end FSBloomFilter
+
+#endif
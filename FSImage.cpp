@@ -0,0 +1,181 @@
+#include "FSImage.h"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char IMAGE_MAGIC[4] = { 'F', 'S', 'T', 'I' };
+const std::uint32_t IMAGE_VERSION = 1;
+const std::size_t IMAGE_HEADER_SIZE = 16;
+const std::size_t IMAGE_ENTRY_MIN_SIZE = 11; // type, name length, offset
+
+namespace
+{
+	std::uint64_t readLE(const unsigned char* bytes, int count)
+	{
+		std::uint64_t value = 0;
+
+		for (int i = count - 1; i >= 0; i--)
+		{
+			value = (value << 8) | bytes[i];
+		}
+
+		return value;
+	}
+
+	void appendLE(std::string& buffer, std::uint64_t value, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			buffer += static_cast<char>((value >> (8 * i)) & 0xFF);
+		}
+	}
+}
+
+FSImage::FSImage(const std::string& fileName)
+	: data(nullptr), size(0), rootOffset(0)
+{
+	struct stat info;
+	int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+	{
+		throw std::runtime_error("File " + fileName + " not found.");
+	}
+
+	if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(IMAGE_HEADER_SIZE))
+	{
+		void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (mapping != MAP_FAILED)
+		{
+			data = static_cast<const unsigned char*>(mapping);
+			size = info.st_size;
+		}
+	}
+	close(fd); // the mapping stays valid
+
+	if (data == nullptr || std::memcmp(data, IMAGE_MAGIC, 4) != 0
+		|| readLE(data + 4, 4) != IMAGE_VERSION)
+	{
+		if (data != nullptr)
+		{
+			munmap(const_cast<unsigned char*>(data), size);
+		}
+		throw std::runtime_error("File " + fileName + " is not a tree snapshot.");
+	}
+
+	rootOffset = readLE(data + 8, 8);
+} // end constructor
+
+std::uint64_t FSImage::getRootOffset() const
+{
+	return rootOffset;
+} // end getRootOffset
+
+std::vector<FSImage::Entry> FSImage::readDirectory(std::uint64_t offset) const
+{
+	std::vector<Entry> entries;
+	std::size_t pos = offset;
+
+	// Sizes are compared against what is left of the file, so a bogus
+	// offset or length cannot overflow the check
+	if (offset < IMAGE_HEADER_SIZE || offset > size || size - pos < 4)
+	{
+		throw std::runtime_error("Corrupt tree snapshot.");
+	}
+
+	std::uint32_t count = readLE(data + pos, 4);
+	pos += 4;
+
+	if (count > (size - pos) / IMAGE_ENTRY_MIN_SIZE)
+	{
+		throw std::runtime_error("Corrupt tree snapshot.");
+	}
+	entries.reserve(count);
+
+	for (std::uint32_t i = 0; i < count; i++)
+	{
+		Entry entry;
+
+		if (size - pos < 3)
+		{
+			throw std::runtime_error("Corrupt tree snapshot.");
+		}
+
+		entry.type = data[pos];
+		std::size_t nameLength = readLE(data + pos + 1, 2);
+		pos += 3;
+
+		if (size - pos < nameLength + 8)
+		{
+			throw std::runtime_error("Corrupt tree snapshot.");
+		}
+
+		entry.name.assign(reinterpret_cast<const char*>(data + pos), nameLength);
+		entry.offset = readLE(data + pos + nameLength, 8);
+		pos += nameLength + 8;
+
+		if (entry.offset >= offset)
+		{
+			throw std::runtime_error("Corrupt tree snapshot.");
+		}
+
+		entries.push_back(std::move(entry));
+	}
+
+	return entries;
+} // end readDirectory
+
+std::size_t FSImage::getSize() const
+{
+	return size;
+} // end getSize
+
+void FSImage::beginImage(std::string& buffer)
+{
+	buffer.append(IMAGE_MAGIC, 4);
+	appendLE(buffer, IMAGE_VERSION, 4);
+	appendLE(buffer, 0, 8); // root offset, patched by endImage()
+} // end beginImage
+
+std::uint64_t FSImage::appendDirectory(std::string& buffer,
+	const std::vector<Entry>& entries)
+{
+	std::uint64_t offset = buffer.size();
+
+	appendLE(buffer, entries.size(), 4);
+	for (const Entry& entry : entries)
+	{
+		if (entry.name.length() > MAX_NAME_LENGTH)
+		{
+			throw std::runtime_error("Name too long for a tree snapshot.");
+		}
+
+		appendLE(buffer, entry.type, 1);
+		appendLE(buffer, entry.name.length(), 2);
+		buffer += entry.name;
+		appendLE(buffer, entry.offset, 8);
+	}
+
+	return offset;
+} // end appendDirectory
+
+void FSImage::endImage(std::string& buffer, std::uint64_t rootOffset)
+{
+	std::string offsetBytes;
+
+	appendLE(offsetBytes, rootOffset, 8);
+	buffer.replace(8, 8, offsetBytes);
+} // end endImage
+
+FSImage::~FSImage()
+{
+	if (data != nullptr)
+	{
+		munmap(const_cast<unsigned char*>(data), size);
+		data = nullptr;
+	}
+} // end destructor
@@ -0,0 +1,99 @@
+#ifndef FSIMAGE
+#define FSIMAGE
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+* FSImage is a read-only, memory-mapped tree snapshot. FilesystemTree uses it
+* to create the children of a directory only when the directory is first
+* visited, so untouched subtrees cost nothing but their file offset.
+*
+* File layout (all integers little-endian):
+*   header:    "FSTI", u32 version, u64 offset of the root directory record
+*   directory: u32 child count, then for each child in sorted order:
+*              u8 type, u16 name length, name bytes, u64 record offset
+*              (the child's directory record, 0 for files)
+*
+* Child records always come before their parent's, so every record offset
+* is smaller than the offset of the record naming it. readDirectory()
+* enforces this, which keeps a damaged file from describing a cycle.
+*/
+class FSImage
+{
+public:
+
+	// One child as stored in a directory record
+	struct Entry
+	{
+		std::string name;
+		int type;
+		std::uint64_t offset; // directory record of the child, 0 for files
+	};
+
+	// Longest name a directory record can hold
+	static const std::size_t MAX_NAME_LENGTH = 0xFFFF;
+
+	/*
+	* Constructor which maps the snapshot file and validates its header.
+	* Throws std::runtime_error if the file is missing or not a snapshot.
+	*
+	* @param fileName Name of the snapshot file.
+	*/
+	FSImage(const std::string& fileName);
+
+	FSImage(const FSImage&) = delete;
+	FSImage& operator=(const FSImage&) = delete;
+
+	/*
+	* @return The offset of the root directory record.
+	*/
+	std::uint64_t getRootOffset() const;
+
+	/*
+	* readDirectory() decodes the directory record at offset. Throws
+	* std::runtime_error if the record lies outside the file or names a
+	* record that does not come before it.
+	*
+	* @param offset Offset of a directory record.
+	* @return The children in the order they were written (sorted by name).
+	*/
+	std::vector<Entry> readDirectory(std::uint64_t offset) const;
+
+	/*
+	* @return Size of the mapping in bytes.
+	*/
+	std::size_t getSize() const;
+
+	/*
+	* beginImage() starts a new snapshot in buffer by writing the header.
+	*/
+	static void beginImage(std::string& buffer);
+
+	/*
+	* appendDirectory() writes a directory record to buffer. Records of
+	* child directories must be written first so their offsets are known.
+	* Throws std::runtime_error if a name is longer than MAX_NAME_LENGTH.
+	*
+	* @return The offset of the new record.
+	*/
+	static std::uint64_t appendDirectory(std::string& buffer,
+		const std::vector<Entry>& entries);
+
+	/*
+	* endImage() records the root directory offset in the header.
+	*/
+	static void endImage(std::string& buffer, std::uint64_t rootOffset);
+
+	~FSImage();
+
+private:
+	const unsigned char* data; // start of the mapping
+	std::size_t size;
+	std::uint64_t rootOffset;
+
+}; // end FSImage
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef FSINLINEVECTOR
+#define FSINLINEVECTOR
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <utility>
+
+/*
+* FSInlineVector is a std::vector replacement that keeps up to N elements
+* inside the object itself and only allocates once it grows past N. Used as
+* a child array, a directory with few entries needs no allocation of its
+* own and its children are read from the node's own cache lines instead of
+* through another pointer.
+*
+* Only the part of the std::vector interface that FSNode and FilesystemTree
+* use is provided. Iterators are plain pointers and, as with std::vector,
+* any change in size invalidates them.
+*/
+template <typename T, std::size_t N>
+class FSInlineVector
+{
+public:
+	typedef T value_type;
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	typedef std::size_t size_type;
+
+	static_assert(N > 0, "FSInlineVector needs at least one inline slot");
+
+	FSInlineVector()
+		: first(inlineData()), count(0), cap(N)
+	{
+	}
+
+	FSInlineVector(const FSInlineVector& other)
+		: FSInlineVector()
+	{
+		assign(other.begin(), other.end());
+	}
+
+	FSInlineVector(FSInlineVector&& other)
+		: FSInlineVector()
+	{
+		takeFrom(other);
+	}
+
+	FSInlineVector& operator=(const FSInlineVector& other)
+	{
+		if (this != &other)
+		{
+			assign(other.begin(), other.end());
+		}
+
+		return *this;
+	}
+
+	FSInlineVector& operator=(FSInlineVector&& other)
+	{
+		if (this != &other)
+		{
+			clear();
+			freeStorage();
+			takeFrom(other);
+		}
+
+		return *this;
+	}
+
+	~FSInlineVector()
+	{
+		clear();
+		freeStorage();
+	}
+
+	iterator begin() { return first; }
+	iterator end() { return first + count; }
+	const_iterator begin() const { return first; }
+	const_iterator end() const { return first + count; }
+
+	size_type size() const { return count; }
+	size_type capacity() const { return cap; }
+	bool empty() const { return count == 0; }
+
+	T& operator[](size_type index) { return first[index]; }
+	const T& operator[](size_type index) const { return first[index]; }
+
+	/*
+	* @return True while the elements are stored in the object itself.
+	*/
+	bool isInline() const
+	{
+		return first == inlineData();
+	}
+
+	void reserve(size_type n)
+	{
+		if (n > cap)
+		{
+			reallocate(n);
+		}
+	}
+
+	/*
+	* shrink_to_fit() moves the elements back inside the object once they
+	* fit, and otherwise into an allocation of exactly their size.
+	*/
+	void shrink_to_fit()
+	{
+		if (!isInline() && count < cap)
+		{
+			reallocate(count);
+		}
+	}
+
+	void clear()
+	{
+		for (size_type i = 0; i < count; i++)
+		{
+			first[i].~T();
+		}
+		count = 0;
+	}
+
+	void resize(size_type n)
+	{
+		reserve(n);
+
+		for (; count < n; count++)
+		{
+			new (first + count) T();
+		}
+		for (; count > n; count--)
+		{
+			first[count - 1].~T();
+		}
+	}
+
+	template <typename InputIt>
+	void assign(InputIt rangeBegin, InputIt rangeEnd)
+	{
+		clear();
+		reserve(std::distance(rangeBegin, rangeEnd));
+
+		for (; rangeBegin != rangeEnd; ++rangeBegin)
+		{
+			new (first + count) T(*rangeBegin);
+			count++;
+		}
+	}
+
+	void push_back(T value)
+	{
+		if (count == cap)
+		{
+			reallocate(cap * 2);
+		}
+
+		new (first + count) T(std::move(value));
+		count++;
+	}
+
+	iterator insert(const_iterator pos, T value)
+	{
+		size_type index = pos - first;
+
+		if (count == cap)
+		{
+			reallocate(cap * 2);
+		}
+
+		if (index == count)
+		{
+			new (first + count) T(std::move(value));
+		}
+		else
+		{
+			// Open a gap at index by shifting the tail up one slot
+			new (first + count) T(std::move(first[count - 1]));
+			std::move_backward(first + index, first + count - 1, first + count);
+			first[index] = std::move(value);
+		}
+		count++;
+
+		return first + index;
+	}
+
+	iterator erase(const_iterator pos)
+	{
+		size_type index = pos - first;
+
+		std::move(first + index + 1, first + count, first + index);
+		first[count - 1].~T();
+		count--;
+
+		return first + index;
+	}
+
+private:
+
+	T* inlineData()
+	{
+		return reinterpret_cast<T*>(inlineStorage);
+	}
+
+	const T* inlineData() const
+	{
+		return reinterpret_cast<const T*>(inlineStorage);
+	}
+
+	/*
+	* reallocate() moves the elements to storage for n of them: the inline
+	* slots if n fits there, otherwise a new allocation. n >= count.
+	*/
+	void reallocate(size_type n)
+	{
+		T* target = (n <= N) ? inlineData() : static_cast<T*>(::operator new(n * sizeof(T)));
+
+		if (target == first)
+		{
+			return;
+		}
+
+		for (size_type i = 0; i < count; i++)
+		{
+			new (target + i) T(std::move(first[i]));
+			first[i].~T();
+		}
+
+		freeStorage();
+		first = target;
+		cap = (n <= N) ? N : n;
+	}
+
+	/*
+	* freeStorage() gives back the allocation, if any. The elements must
+	* already be destroyed or moved out.
+	*/
+	void freeStorage()
+	{
+		if (!isInline())
+		{
+			::operator delete(first);
+		}
+	}
+
+	/*
+	* takeFrom() moves other's elements into this empty, inline vector and
+	* leaves other empty and inline.
+	*/
+	void takeFrom(FSInlineVector& other)
+	{
+		if (other.isInline())
+		{
+			for (size_type i = 0; i < other.count; i++)
+			{
+				new (inlineData() + i) T(std::move(other.first[i]));
+			}
+			first = inlineData();
+			count = other.count;
+			cap = N;
+			other.clear();
+		}
+		else
+		{
+			first = other.first;
+			count = other.count;
+			cap = other.cap;
+			other.first = other.inlineData();
+			other.count = 0;
+			other.cap = N;
+		}
+	}
+
+	T* first; // inlineData() or an allocation of cap elements
+	size_type count;
+	size_type cap;
+	alignas(T) unsigned char inlineStorage[N * sizeof(T)];
+
+}; // end FSInlineVector
+
+#endif
@@ -1,33 +1,60 @@
+#include <algorithm>
 #include <cstddef>
-#include <cctype>
 #include "FSNode.h"
 
+// Links only with translation units built with the same policies
+const int FS_POLICY_TAG = 0;
+
 int FSNode::getType() const
 {
 	return type;
 }
 
-FSNode::FSNode(const std::string& pName, int pType) : type(pType)
+FSNode::FSNode(const std::string& pName, int pType) 
+	: type(pType), imageOffset(0), dirty(false), inArena(false), filterStale(false)
 { 
 	setName(pName);
+
+	// A new directory is empty, so its empty filter is exact
+	if (isDirectory())
+	{
+		subtreeFilter.reset(new FSBloomFilter());
+	}
 }  // end constructor
 
 
 void FSNode::setName(const std::string& pName)
+{
+	name = cleanName(pName);
+}  // end setName
+
+std::string FSNode::cleanName(const std::string& pName)
 {
 	std::string goodName;
 
-	// Only allow alpha and digits in name. No spaces or special char.
+	// Only allow characters the name policy allows (by default alpha and 
+	// digits). No spaces or special char.
 	for (unsigned int i = 0; i < pName.length(); i++)
 	{
-		if (isalpha(pName[i]) || isdigit(pName[i]))
+		if (FSNamePolicy::isAllowed(pName[i]))
 		{
-			goodName += pName[i];
+			goodName += FSNamePolicy::fold(pName[i]);
 		}
 	}
 
-	name = goodName;
-}  // end setName
+	return goodName;
+}  // end cleanName
+
+void FSNode::foldName(std::string& pName)
+{
+	if (FSNamePolicy::FOLDS_CASE)
+	{
+		for (unsigned int i = 0; i < pName.length(); i++)
+		{
+			pName[i] = FSNamePolicy::fold(pName[i]);
+		}
+	}
+}  // end foldName
 
 
 std::string FSNode::getName() const
@@ -49,19 +76,18 @@ bool FSNode::addChild(std::shared_ptr<FSNode> childPtr)
 {
 	bool rValue = false;
 
-	if (childPtr != nullptr 
-		&& isDirectory() // can't add child to directory
-		&& getChild(childPtr->getName()) == nullptr) // don't allow duplicate children
+	if (childPtr != nullptr && isDirectory()) // can't add child to directory
 	{
 		// Keep children sorted
-		unsigned int pos = 0;
-		while ((pos < children.size()) && (children[pos]->getName() < childPtr->getName()))
+		unsigned int pos = lowerBound(childPtr->getName());
+
+		// don't allow duplicate children
+		if (pos == children.size() || children[pos]->name != childPtr->name)
 		{
-			pos++;
-		}
-		children.insert(children.begin() + pos, childPtr);
+			children.insert(children.begin() + pos, childPtr);
 
-		rValue = true;
+			rValue = true;
+		}
 	}
 
 	return rValue;
@@ -81,16 +107,30 @@ std::shared_ptr<FSNode> FSNode::getChild(int index) const
 
 std::shared_ptr<FSNode> FSNode::getChild(std::string pName) const
 {
+	foldName(pName);
 
-	for (unsigned int i = 0; i < children.size(); i++)
+	unsigned int pos = lowerBound(pName);
+
+	if (pos < children.size() && children[pos]->name == pName)
 	{
-		if (children[i]->getName() == pName)
-			return children[i];
+		return children[pos];
 	}
 
 	return nullptr;
 }  // end getChild
 
+int FSNode::lowerBound(const std::string& pName) const
+{
+	ChildArray::const_iterator pos = std::lower_bound(
+		children.begin(), children.end(), pName,
+		[](const std::shared_ptr<FSNode>& childPtr, const std::string& name)
+		{
+			return childPtr->name < name;
+		});
+
+	return pos - children.begin();
+}  // end lowerBound
+
 int FSNode::getNumChildren() const
 {
 	return children.size();
@@ -98,15 +138,24 @@ int FSNode::getNumChildren() const
 
 bool FSNode::removeChild(const std::string& pName)
 {
+	std::string foldedName;
+	const std::string* keyPtr = &pName;
+
+	if (FSNamePolicy::FOLDS_CASE)
+	{
+		foldedName = pName;
+		foldName(foldedName);
+		keyPtr = &foldedName;
+	}
+
 	if (isDirectory())
 	{
-		for (unsigned int i = 0; i < children.size(); i++)
+		unsigned int pos = lowerBound(*keyPtr);
+
+		if (pos < children.size() && children[pos]->name == *keyPtr)
 		{
-			if (children[i]->getName() == pName)
-			{
-				children.erase(children.begin() + i);
-				return true;
-			}
+			children.erase(children.begin() + pos);
+			return true;
 		}
 	}
 
@@ -1,12 +1,15 @@
 #ifndef FSNODE
 #define FSNODE
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <string>
+#include "FSPolicy.h"
+#include "FSBloomFilter.h"
 
-const int DIR_TYPE = 1; // Constant used to indicate node is a directory
-const int FILE_TYPE = 0; // Constant used to indicate node is a file
+constexpr int DIR_TYPE = 1; // Constant used to indicate node is a directory
+constexpr int FILE_TYPE = 0; // Constant used to indicate node is a file
 
 class FSNode
 {
@@ -24,12 +27,26 @@ public:
 	FSNode(const std::string& pName, int pType);
 
 	/*
-	* setName() changes the name of the node. Names may ONLY contain alpha and
-	*           digit characters.
+	* setName() changes the name of the node. Names may ONLY contain the
+	*           characters FSNamePolicy allows (by default alpha and digit
+	*           characters), folded by the policy.
 	*
 	* @param pName The name of the file/directory. 
 	*/
 	void setName(const std::string& pName);
+
+	/*
+	* cleanName() returns the name setName() would store for pName.
+	*/
+	static std::string cleanName(const std::string& pName);
+
+	/*
+	* foldName() folds a name given to a lookup the way FSNamePolicy folds
+	* stored names. Does nothing unless the policy folds case.
+	*
+	* @param pName The name to fold in place.
+	*/
+	static void foldName(std::string& pName);
 	
 	/*
 	* getName() returns the name of the node.
@@ -68,7 +85,7 @@ public:
 	std::shared_ptr<FSNode> getChild(int index) const;
 
 	/*
-	* getChild() returns pointer to child with matching name.
+	* getChild() returns pointer to child with matching (folded) name.
 
 	* @param pName Name of the child to return a pointer to.
 	* @return pointer to a child with the given name, nullptr if no child exists
@@ -76,6 +93,16 @@ public:
 	*/
 	std::shared_ptr<FSNode> getChild(std::string pName) const;
 
+	/*
+	* lowerBound() finds where a name is, or would be, in the sorted children.
+	* Runs in O(log n).
+	*
+	* @param pName Name to look for.
+	* @return Index of the first child whose name is not less than pName,
+	*         getNumChildren() if there is none.
+	*/
+	int lowerBound(const std::string& pName) const;
+
 	/*
 	* getNumChildren() returns the total number of children.
 	*
@@ -91,7 +118,8 @@ public:
 	int getType() const;
 
 	/*
-	* removeChild() removes the child with the given name from the directory. 
+	* removeChild() removes the child with the given (folded) name from the
+	* directory. 
 	*
 	* @param pName Name of the child to remove.
 	* @return True if the child was successfully removed.
@@ -103,8 +131,30 @@ private:
 	int type; // 1 = directory, 0 = file
 
 	/* If this is a directory it may contain other files and directories.
-	These are linked to in the vector of pointers named children. */
-	std::vector<std::shared_ptr<FSNode>> children;
+	These are linked to in the array of pointers named children, stored as
+	FSChildPolicy decides. */
+	typedef FSChildPolicy::Array<std::shared_ptr<FSNode>> ChildArray;
+	ChildArray children;
+
+	/* Directories loaded from a snapshot start out unhydrated: children is
+	empty and imageOffset is the offset of their record in the snapshot.
+	imageOffset is 0 once children has been filled in. */
+	std::uint64_t imageOffset;
+
+	/* true once a hydrated directory has been changed after loading. */
+	bool dirty;
+
+	/* true if the node was placed in an FSArena by compaction rather than
+	allocated on its own. */
+	bool inArena;
+
+	/* Directories summarize the names of everything below them in a Bloom
+	filter so find() can skip subtrees. nullptr means the contents are not
+	known (e.g. not yet loaded from a snapshot), which disables skipping.
+	filterStale is set when names may have been removed since the filter
+	was built, so it may be less selective than a rebuilt one. */
+	std::unique_ptr<FSBloomFilter> subtreeFilter;
+	bool filterStale;
 
 	/*
 	* FilesystemTree is a friend to allow direct access to name. This allows
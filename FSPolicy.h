@@ -0,0 +1,133 @@
+#ifndef FSPOLICY
+#define FSPOLICY
+
+#include <cstddef>
+#include <vector>
+#include "FSInlineVector.h"
+
+/*
+* Compile-time policies for FSNode and FilesystemTree. A build picks its
+* policies with preprocessor definitions, so one codebase can produce (and
+* benchmark) each variant, and a variant pays nothing for features it leaves
+* out:
+*
+*   -DFS_NAME_POLICY=<type>  Which characters names may contain and whether
+*                            they are case folded. Defaults to AlnumNames.
+*                            Must be a plain identifier.
+*   -DFS_CHILD_POLICY=<type> How a directory stores its sorted child
+*                            array. Defaults to VectorChildren. Must be a
+*                            plain identifier.
+*   -DFS_SINGLE_THREADED     Never use worker threads (parallel copies and
+*                            exports, shard workers). The thread pool is not
+*                            even started. This adds no locking when off:
+*                            a FilesystemTree must not be used from other
+*                            threads while it changes, ShardedFilesystemTree
+*                            is.
+*
+* The policies are whole-build switches, not template parameters, so one
+* binary holds exactly one variant and every translation unit must be built
+* with the same definitions. A translation unit built with different ones
+* fails to link (see FS_POLICY_TAG) instead of silently mixing variants.
+*
+* Not (yet) a policy: name storage (std::string), which most of
+* FilesystemTree reaches directly.
+*/
+
+/*
+* Name policies. isAllowed() decides which characters setName() keeps and
+* fold() maps each kept character to its stored form. When FOLDS_CASE is
+* true names given to lookups are folded the same way, so lookups match
+* regardless of case.
+*/
+struct AlnumNames
+{
+	static constexpr const char* NAME = "AlnumNames";
+	static constexpr bool FOLDS_CASE = false;
+
+	static constexpr bool isAllowed(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+			|| (c >= '0' && c <= '9');
+	}
+
+	static constexpr char fold(char c)
+	{
+		return c;
+	}
+};
+
+struct CaseFoldedAlnumNames
+{
+	static constexpr const char* NAME = "CaseFoldedAlnumNames";
+	static constexpr bool FOLDS_CASE = true;
+
+	static constexpr bool isAllowed(char c)
+	{
+		return AlnumNames::isAllowed(c);
+	}
+
+	static constexpr char fold(char c)
+	{
+		return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+	}
+};
+
+#ifndef FS_NAME_POLICY
+#define FS_NAME_POLICY AlnumNames
+#endif
+
+typedef FS_NAME_POLICY FSNamePolicy;
+
+/*
+* Child container policies. Array<T> is the type of a directory's child
+* array, which is kept sorted by name either way.
+*
+* VectorChildren uses std::vector: every non-empty directory allocates its
+* array separately. InlineChildren keeps up to SLOTS children inside the
+* node and allocates only past that, which saves an allocation and a cache
+* miss per small directory during lookups and traversals, at the price of
+* SLOTS unused slots in every file node.
+*/
+struct VectorChildren
+{
+	static constexpr const char* NAME = "VectorChildren";
+
+	template <typename T>
+	using Array = std::vector<T>;
+};
+
+struct InlineChildren
+{
+	static constexpr const char* NAME = "InlineChildren";
+	static constexpr std::size_t SLOTS = 4;
+
+	template <typename T>
+	using Array = FSInlineVector<T, SLOTS>;
+};
+
+#ifndef FS_CHILD_POLICY
+#define FS_CHILD_POLICY VectorChildren
+#endif
+
+typedef FS_CHILD_POLICY FSChildPolicy;
+
+#ifdef FS_SINGLE_THREADED
+constexpr bool FS_USE_THREADS = false;
+#define FS_THREAD_TAG singleThreaded
+#else
+constexpr bool FS_USE_THREADS = true;
+#define FS_THREAD_TAG threaded
+#endif
+
+// FS_POLICY_TAG names a symbol for the chosen variant, such as
+// fsPolicy_AlnumNames_VectorChildren_threaded. FSNode.cpp defines it and
+// every translation unit including this header refers to it, so the link
+// fails when two of them were built with different policies.
+#define FS_POLICY_JOIN(name, children, threads) fsPolicy_##name##_##children##_##threads
+#define FS_POLICY_EXPAND(name, children, threads) FS_POLICY_JOIN(name, children, threads)
+#define FS_POLICY_TAG FS_POLICY_EXPAND(FS_NAME_POLICY, FS_CHILD_POLICY, FS_THREAD_TAG)
+
+extern const int FS_POLICY_TAG;
+static const int* const FS_POLICY_CHECK = &FS_POLICY_TAG;
+
+#endif
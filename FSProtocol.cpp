@@ -0,0 +1,155 @@
+#include "FSProtocol.h"
+
+FSFrameReader::FSFrameReader(const char* pData, std::uint32_t pSize)
+	: data(pData), size(pSize), pos(0), ok(true)
+{
+} // end constructor
+
+bool FSFrameReader::readU8(std::uint8_t& value)
+{
+	if (ok && pos + 1 <= size)
+	{
+		value = static_cast<std::uint8_t>(data[pos]);
+		pos += 1;
+	}
+	else
+	{
+		ok = false;
+	}
+
+	return ok;
+} // end readU8
+
+bool FSFrameReader::readU32(std::uint32_t& value)
+{
+	if (ok && pos + 4 <= size)
+	{
+		value = 0;
+		for (int i = 3; i >= 0; i--)
+		{
+			value = (value << 8) | static_cast<std::uint8_t>(data[pos + i]);
+		}
+		pos += 4;
+	}
+	else
+	{
+		ok = false;
+	}
+
+	return ok;
+} // end readU32
+
+bool FSFrameReader::readString(std::string& value)
+{
+	std::uint32_t length = 0;
+
+	if (ok && pos + 2 <= size)
+	{
+		length = static_cast<std::uint8_t>(data[pos])
+			| (static_cast<std::uint8_t>(data[pos + 1]) << 8);
+		pos += 2;
+	}
+	else
+	{
+		ok = false;
+	}
+
+	if (ok && pos + length <= size)
+	{
+		value.assign(data + pos, length);
+		pos += length;
+	}
+	else
+	{
+		ok = false;
+	}
+
+	return ok;
+} // end readString
+
+bool FSFrameReader::readText(std::string& value)
+{
+	std::uint32_t length = 0;
+
+	if (readU32(length) && pos + length <= size)
+	{
+		value.assign(data + pos, length);
+		pos += length;
+	}
+	else
+	{
+		ok = false;
+	}
+
+	return ok;
+} // end readText
+
+bool FSFrameReader::atEnd() const
+{
+	return ok && pos == size;
+} // end atEnd
+
+std::size_t beginFrame(std::string& buffer)
+{
+	std::size_t frameStart = buffer.size();
+
+	buffer.append(FRAME_HEADER_SIZE, '\0'); // patched by endFrame()
+
+	return frameStart;
+} // end beginFrame
+
+void endFrame(std::string& buffer, std::size_t frameStart)
+{
+	std::uint32_t bodySize = static_cast<std::uint32_t>(
+		buffer.size() - frameStart - FRAME_HEADER_SIZE);
+
+	for (unsigned int i = 0; i < FRAME_HEADER_SIZE; i++)
+	{
+		buffer[frameStart + i] = static_cast<char>((bodySize >> (8 * i)) & 0xFF);
+	}
+} // end endFrame
+
+void appendU8(std::string& buffer, std::uint8_t value)
+{
+	buffer += static_cast<char>(value);
+} // end appendU8
+
+void appendU32(std::string& buffer, std::uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		buffer += static_cast<char>((value >> (8 * i)) & 0xFF);
+	}
+} // end appendU32
+
+bool appendString(std::string& buffer, const std::string& value)
+{
+	if (value.length() > MAX_STRING_LENGTH)
+	{
+		return false;
+	}
+
+	buffer += static_cast<char>(value.length() & 0xFF);
+	buffer += static_cast<char>((value.length() >> 8) & 0xFF);
+	buffer += value;
+
+	return true;
+} // end appendString
+
+void appendText(std::string& buffer, const std::string& value)
+{
+	appendU32(buffer, static_cast<std::uint32_t>(value.length()));
+	buffer += value;
+} // end appendText
+
+std::uint32_t peekFrameSize(const char* data)
+{
+	std::uint32_t value = 0;
+
+	for (int i = FRAME_HEADER_SIZE - 1; i >= 0; i--)
+	{
+		value = (value << 8) | static_cast<std::uint8_t>(data[i]);
+	}
+
+	return value;
+} // end peekFrameSize
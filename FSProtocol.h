@@ -0,0 +1,108 @@
+#ifndef FSPROTOCOL
+#define FSPROTOCOL
+
+#include <cstdint>
+#include <string>
+
+/*
+* Binary framing shared by FilesystemServer and its clients.
+*
+* Every message is a frame: a 4 byte little-endian body length followed by
+* the body. A request body is a 1 byte opcode followed by its arguments. A
+* response body is a 1 byte status, a 4 byte little-endian integer result
+* and a 4 byte length-prefixed text payload (used by find and stats).
+*
+* Request arguments by opcode (str = 2 byte length-prefixed bytes):
+*   OP_CREATE  u8 type, str name, str parentPath
+*   OP_REMOVE  str name, str parentPath
+*   OP_MOVE    str name, str sourcePath, str destPath
+*   OP_COPY    str name, str sourcePath, str destPath
+*   OP_FIND    str name, str startPath
+*   OP_STATS   (none)
+*/
+
+const std::uint8_t OP_CREATE = 1;
+const std::uint8_t OP_REMOVE = 2;
+const std::uint8_t OP_MOVE = 3;
+const std::uint8_t OP_COPY = 4;
+const std::uint8_t OP_FIND = 5;
+const std::uint8_t OP_STATS = 6;
+
+const std::uint8_t STATUS_OK = 0; // request executed, see result
+const std::uint8_t STATUS_BAD_REQUEST = 1; // unknown opcode or malformed body
+
+const std::uint32_t FRAME_HEADER_SIZE = 4;
+const std::uint32_t MAX_FRAME_SIZE = 1 << 20; // larger frames drop the client
+const std::uint32_t MAX_STRING_LENGTH = 0xFFFF; // longest str field
+
+/*
+* FSFrameReader walks the fields of a single frame body. Every read fails
+* (returns false) once the body is exhausted, so a malformed frame can be
+* detected by checking the final call only.
+*/
+class FSFrameReader
+{
+public:
+
+	/*
+	* @param pData Start of the frame body. Must stay valid while reading.
+	* @param pSize Length of the frame body in bytes.
+	*/
+	FSFrameReader(const char* pData, std::uint32_t pSize);
+
+	bool readU8(std::uint8_t& value);
+	bool readU32(std::uint32_t& value);
+
+	/*
+	* readString() reads a 2 byte length-prefixed string.
+	*/
+	bool readString(std::string& value);
+
+	/*
+	* readText() reads a 4 byte length-prefixed string.
+	*/
+	bool readText(std::string& value);
+
+	/*
+	* @return true if every byte of the body has been consumed.
+	*/
+	bool atEnd() const;
+
+private:
+	const char* data;
+	std::uint32_t size;
+	std::uint32_t pos;
+	bool ok;
+
+}; // end FSFrameReader
+
+/*
+* Helpers that append encoded fields to a buffer. A frame is built by
+* calling beginFrame(), appending the body and then calling endFrame() with
+* the offset beginFrame() returned.
+*/
+std::size_t beginFrame(std::string& buffer);
+void endFrame(std::string& buffer, std::size_t frameStart);
+void appendU8(std::string& buffer, std::uint8_t value);
+void appendU32(std::string& buffer, std::uint32_t value);
+void appendText(std::string& buffer, const std::string& value);
+
+/*
+* appendString() appends a str field. A value longer than MAX_STRING_LENGTH
+* cannot be encoded and is left out entirely, so a frame sent anyway is
+* malformed and answered with STATUS_BAD_REQUEST rather than executed with
+* a shortened name or path.
+*
+* @return False if value was too long and nothing was appended.
+*/
+bool appendString(std::string& buffer, const std::string& value);
+
+/*
+* peekFrameSize() reads the body length of the frame starting at data.
+*
+* @param data Buffer holding at least FRAME_HEADER_SIZE bytes.
+* @return The body length in bytes (not counting the header).
+*/
+std::uint32_t peekFrameSize(const char* data);
+
+#endif
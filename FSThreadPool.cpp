@@ -0,0 +1,81 @@
+#include "FSThreadPool.h"
+
+FSThreadPool::FSThreadPool(unsigned int threadCount) : stopping(false)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::thread::hardware_concurrency();
+	}
+	if (threadCount == 0)
+	{
+		threadCount = 1; // core count unknown
+	}
+
+	for (unsigned int i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&FSThreadPool::workerLoop, this);
+	}
+} // end constructor
+
+std::future<void> FSThreadPool::submit(std::function<void()> task)
+{
+	std::packaged_task<void()> packagedTask(std::move(task));
+	std::future<void> result = packagedTask.get_future();
+
+	{
+		std::lock_guard<std::mutex> lock(tasksMutex);
+		tasks.push(std::move(packagedTask));
+	}
+	tasksReady.notify_one();
+
+	return result;
+} // end submit
+
+unsigned int FSThreadPool::getThreadCount() const
+{
+	return workers.size();
+} // end getThreadCount
+
+FSThreadPool& FSThreadPool::shared()
+{
+	static FSThreadPool pool;
+
+	return pool;
+} // end shared
+
+void FSThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::packaged_task<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(tasksMutex);
+			tasksReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+			if (tasks.empty())
+			{
+				return; // stopping and nothing left to do
+			}
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+
+		task(); // exceptions are stored in the task's future
+	}
+} // end workerLoop
+
+FSThreadPool::~FSThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(tasksMutex);
+		stopping = true;
+	}
+	tasksReady.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+} // end destructor
@@ -0,0 +1,71 @@
+#ifndef FSTHREADPOOL
+#define FSTHREADPOOL
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/*
+* FSThreadPool is a fixed set of worker threads that run submitted tasks in
+* FIFO order. Tasks must not wait on other tasks of the same pool, since
+* every worker could end up blocked waiting on work that is still queued.
+*/
+class FSThreadPool
+{
+public:
+
+	/*
+	* Constructor which starts the workers.
+	*
+	* @param threadCount Number of worker threads. 0 uses one per core.
+	*/
+	FSThreadPool(unsigned int threadCount = 0);
+
+	FSThreadPool(const FSThreadPool&) = delete;
+	FSThreadPool& operator=(const FSThreadPool&) = delete;
+
+	/*
+	* submit() queues a task.
+	*
+	* @param task The function to run on a worker.
+	* @return A future that becomes ready when the task has finished and
+	*         rethrows any exception the task threw.
+	*/
+	std::future<void> submit(std::function<void()> task);
+
+	/*
+	* @return The number of worker threads.
+	*/
+	unsigned int getThreadCount() const;
+
+	/*
+	* shared() returns a process-wide pool with one worker per core, created
+	* on first use.
+	*/
+	static FSThreadPool& shared();
+
+	/*
+	* Destructor which finishes every queued task, then stops the workers.
+	*/
+	~FSThreadPool();
+
+private:
+
+	/*
+	* workerLoop() runs queued tasks until the pool is destroyed.
+	*/
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::queue<std::packaged_task<void()>> tasks;
+	std::mutex tasksMutex;
+	std::condition_variable tasksReady;
+	bool stopping;
+
+}; // end FSThreadPool
+
+#endif
@@ -0,0 +1,178 @@
+#include "FSTrace.h"
+#include "FSProtocol.h"
+#include <iterator>
+#include <stdexcept>
+
+// Buffered records are written out once they reach this size
+const std::size_t TRACE_FLUSH_BYTES = 1 << 16;
+
+const char TRACE_MAGIC[4] = { 'F', 'S', 'T', 'R' };
+
+FSTraceWriter::FSTraceWriter(const std::string& fileName)
+	: recordCount(0)
+{
+	outFile.open(fileName.c_str(), std::ios::binary | std::ios::trunc);
+	if (outFile.fail())
+	{
+		throw std::runtime_error("Could not create trace file " + fileName + ".");
+	}
+
+	buffer.append(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	appendU32(buffer, TRACE_VERSION);
+} // end constructor
+
+void FSTraceWriter::write(const FSTraceRecord& record)
+{
+	std::size_t frameStart = beginFrame(buffer);
+
+	appendU8(buffer, record.op);
+	appendU32(buffer, record.elapsedNanos);
+	appendU32(buffer, record.result);
+
+	switch (record.op)
+	{
+	case TRACE_CREATE:
+		appendU8(buffer, static_cast<std::uint8_t>(record.number));
+		appendText(buffer, record.name);
+		appendText(buffer, record.path);
+		break;
+	case TRACE_REMOVE:
+	case TRACE_FIND:
+		appendText(buffer, record.name);
+		appendText(buffer, record.path);
+		break;
+	case TRACE_MOVE:
+	case TRACE_COPY:
+		appendText(buffer, record.name);
+		appendText(buffer, record.path);
+		appendText(buffer, record.destPath);
+		break;
+	case TRACE_LIST:
+		appendText(buffer, record.path);
+		appendText(buffer, record.name);
+		appendText(buffer, record.destPath);
+		appendU32(buffer, record.number);
+		break;
+	case TRACE_EXPORT:
+		appendU8(buffer, static_cast<std::uint8_t>(record.number));
+		appendText(buffer, record.path);
+		break;
+	default:
+		break;
+	}
+
+	endFrame(buffer, frameStart);
+	recordCount++;
+
+	if (buffer.size() >= TRACE_FLUSH_BYTES)
+	{
+		outFile.write(buffer.data(), buffer.size());
+		buffer.clear();
+	}
+} // end write
+
+std::size_t FSTraceWriter::getRecordCount() const
+{
+	return recordCount;
+} // end getRecordCount
+
+FSTraceWriter::~FSTraceWriter()
+{
+	outFile.write(buffer.data(), buffer.size());
+} // end destructor
+
+std::vector<FSTraceRecord> readTrace(const std::string& fileName)
+{
+	std::vector<FSTraceRecord> records;
+	std::ifstream inFile(fileName.c_str(), std::ios::binary);
+
+	if (inFile.fail())
+	{
+		throw std::runtime_error("Trace file " + fileName + " not found.");
+	}
+
+	std::string data((std::istreambuf_iterator<char>(inFile)),
+		std::istreambuf_iterator<char>());
+	std::size_t headerSize = sizeof(TRACE_MAGIC) + 4;
+	std::uint32_t version = 0;
+
+	if (data.size() >= headerSize)
+	{
+		FSFrameReader header(data.data() + sizeof(TRACE_MAGIC), 4);
+		header.readU32(version);
+	}
+
+	if (data.size() < headerSize
+		|| data.compare(0, sizeof(TRACE_MAGIC), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+		|| version != TRACE_VERSION)
+	{
+		throw std::runtime_error(fileName + " is not a trace file.");
+	}
+
+	std::size_t pos = headerSize;
+
+	while (pos + FRAME_HEADER_SIZE <= data.size()
+		&& pos + FRAME_HEADER_SIZE + peekFrameSize(data.data() + pos) <= data.size())
+	{
+		std::uint32_t bodySize = peekFrameSize(data.data() + pos);
+		FSFrameReader reader(data.data() + pos + FRAME_HEADER_SIZE, bodySize);
+		FSTraceRecord record;
+		std::uint8_t small = 0;
+
+		reader.readU8(record.op);
+		reader.readU32(record.elapsedNanos);
+		reader.readU32(record.result);
+
+		switch (record.op)
+		{
+		case TRACE_CREATE:
+			reader.readU8(small);
+			record.number = small;
+			reader.readText(record.name);
+			reader.readText(record.path);
+			break;
+		case TRACE_REMOVE:
+		case TRACE_FIND:
+			reader.readText(record.name);
+			reader.readText(record.path);
+			break;
+		case TRACE_MOVE:
+		case TRACE_COPY:
+			reader.readText(record.name);
+			reader.readText(record.path);
+			reader.readText(record.destPath);
+			break;
+		case TRACE_LIST:
+			reader.readText(record.path);
+			reader.readText(record.name);
+			reader.readText(record.destPath);
+			reader.readU32(record.number);
+			break;
+		case TRACE_EXPORT:
+			reader.readU8(small);
+			record.number = small;
+			reader.readText(record.path);
+			break;
+		default:
+			break;
+		}
+
+		if (!reader.atEnd() || record.op == 0 || record.op >= TRACE_OP_COUNT)
+		{
+			throw std::runtime_error("Malformed record in trace file " + fileName + ".");
+		}
+
+		records.push_back(record);
+		pos += FRAME_HEADER_SIZE + bodySize;
+	}
+
+	return records;
+} // end readTrace
+
+const char* traceOpName(std::uint8_t op)
+{
+	const char* NAMES[TRACE_OP_COUNT] = { "?", "create", "remove", "move",
+		"copy", "find", "list", "export", "display", "stats", "format" };
+
+	return (op < TRACE_OP_COUNT) ? NAMES[op] : "?";
+} // end traceOpName
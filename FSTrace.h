@@ -0,0 +1,114 @@
+#ifndef FSTRACE
+#define FSTRACE
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+* Operation traces recorded by FilesystemTree::startTrace() and replayed by
+* the replay tool.
+*
+* File layout (all integers little-endian): "FSTR", u32 version, then one
+* record per call framed like FSProtocol messages (u32 body length, body).
+* A record body is u8 op, u32 elapsed nanoseconds (saturated), u32 result
+* (1/0 for success, the match or name count for find and list), then the
+* arguments (text = 4 byte length-prefixed string, so a name of any length
+* is recorded as given):
+*   TRACE_CREATE   u8 type, text name, text parentPath
+*   TRACE_REMOVE   text name, text parentPath
+*   TRACE_MOVE     text name, text sourcePath, text destPath
+*   TRACE_COPY     text name, text sourcePath, text destPath
+*   TRACE_FIND     text name, text startPath
+*   TRACE_LIST     text path, text prefix, text startAfter, u32 limit
+*   TRACE_EXPORT   u8 format, text path
+*   TRACE_DISPLAY, TRACE_STATS, TRACE_FORMAT   (none)
+*/
+
+const std::uint8_t TRACE_CREATE = 1;
+const std::uint8_t TRACE_REMOVE = 2;
+const std::uint8_t TRACE_MOVE = 3;
+const std::uint8_t TRACE_COPY = 4;
+const std::uint8_t TRACE_FIND = 5;
+const std::uint8_t TRACE_LIST = 6;
+const std::uint8_t TRACE_EXPORT = 7;
+const std::uint8_t TRACE_DISPLAY = 8;
+const std::uint8_t TRACE_STATS = 9;
+const std::uint8_t TRACE_FORMAT = 10;
+const std::uint8_t TRACE_OP_COUNT = 11; // one past the largest op
+
+const std::uint32_t TRACE_VERSION = 2;
+
+/*
+* FSTraceRecord is one traced call. Fields an op does not use are left
+* empty. TRACE_LIST keeps its prefix in name and its cursor in destPath.
+*/
+struct FSTraceRecord
+{
+	std::uint8_t op = 0; // one of the TRACE_ constants
+	std::uint32_t elapsedNanos = 0;
+	std::uint32_t result = 0;
+	std::uint32_t number = 0; // type, export format or list limit
+	std::string name;
+	std::string path;
+	std::string destPath;
+};
+
+/*
+* FSTraceWriter appends records to a trace file, buffering them so a traced
+* call costs a few appends to memory.
+*/
+class FSTraceWriter
+{
+public:
+
+	/*
+	* Constructor which creates the trace file and writes its header.
+	* Throws std::runtime_error if the file cannot be created.
+	*
+	* @param fileName Name of the trace file. Replaced if it exists.
+	*/
+	FSTraceWriter(const std::string& fileName);
+
+	FSTraceWriter(const FSTraceWriter&) = delete;
+	FSTraceWriter& operator=(const FSTraceWriter&) = delete;
+
+	/*
+	* write() encodes a record, writing the buffer out once it is full.
+	*/
+	void write(const FSTraceRecord& record);
+
+	/*
+	* @return Number of records written so far.
+	*/
+	std::size_t getRecordCount() const;
+
+	/*
+	* Destructor which writes out any buffered records.
+	*/
+	~FSTraceWriter();
+
+private:
+	std::ofstream outFile;
+	std::string buffer;
+	std::size_t recordCount;
+
+}; // end FSTraceWriter
+
+/*
+* readTrace() decodes a whole trace file. A truncated final record, as left
+* by a process that stopped mid-write, is dropped. Throws std::runtime_error
+* if the file is missing, not a trace or holds a malformed record.
+*
+* @param fileName Name of the trace file.
+* @return The records in the order the calls finished.
+*/
+std::vector<FSTraceRecord> readTrace(const std::string& fileName);
+
+/*
+* @return A short name for a TRACE_ op, such as "create".
+*/
+const char* traceOpName(std::uint8_t op);
+
+#endif
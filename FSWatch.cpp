@@ -0,0 +1,79 @@
+#include "FSWatch.h"
+#include <utility>
+
+bool FSEvent::operator==(const FSEvent& rEvent) const
+{
+	return kind == rEvent.kind && name == rEvent.name && path == rEvent.path
+		&& destPath == rEvent.destPath;
+} // end operator==
+
+FSEventQueue::FSEventQueue(std::size_t capacity)
+	: head(0), tail(0), overflowed(false), droppedCount(0), coalescedCount(0)
+{
+	std::size_t size = 1;
+
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	slots.resize(size);
+	mask = size - 1;
+} // end constructor
+
+bool FSEventQueue::push(const FSEvent& event)
+{
+	std::size_t tailPos = tail.load(std::memory_order_relaxed);
+	std::size_t headPos = head.load(std::memory_order_acquire);
+
+	// While head has not reached tail the newest event is still queued
+	if (tailPos != headPos && event == lastPushed)
+	{
+		coalescedCount.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	if (tailPos - headPos > mask)
+	{
+		overflowed.store(true, std::memory_order_release);
+		droppedCount.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	slots[tailPos & mask] = event; // reuses the slot's string buffers
+	lastPushed = event;
+	tail.store(tailPos + 1, std::memory_order_release);
+
+	return true;
+} // end push
+
+bool FSEventQueue::pop(FSEvent& event)
+{
+	std::size_t headPos = head.load(std::memory_order_relaxed);
+
+	if (headPos == tail.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	// The producer does not touch a slot again until head passes it
+	std::swap(event, slots[headPos & mask]);
+	head.store(headPos + 1, std::memory_order_release);
+
+	return true;
+} // end pop
+
+bool FSEventQueue::takeOverflow()
+{
+	return overflowed.exchange(false, std::memory_order_acq_rel);
+} // end takeOverflow
+
+std::size_t FSEventQueue::getDroppedCount() const
+{
+	return droppedCount.load(std::memory_order_relaxed);
+} // end getDroppedCount
+
+std::size_t FSEventQueue::getCoalescedCount() const
+{
+	return coalescedCount.load(std::memory_order_relaxed);
+} // end getCoalescedCount
@@ -0,0 +1,108 @@
+#ifndef FSWATCH
+#define FSWATCH
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Kinds of change reported to watchers
+constexpr int EVENT_CREATE = 0;
+constexpr int EVENT_REMOVE = 1;
+constexpr int EVENT_MOVE = 2;
+constexpr int EVENT_COPY = 3;
+constexpr int EVENT_FORMAT = 4;
+
+/*
+* FSEvent describes one successful change to a FilesystemTree.
+*/
+struct FSEvent
+{
+	int kind = EVENT_CREATE; // one of the EVENT_ constants
+	std::string path; // directory the change happened in (source for move/copy)
+	std::string name; // name of the created/removed/moved/copied entry
+	std::string destPath; // destination directory of a move or copy, else ""
+
+	bool operator==(const FSEvent& rEvent) const;
+};
+
+/*
+* FSEventQueue is a bounded, lock-free single-producer/single-consumer ring
+* of events. The thread changing the tree pushes and never waits. One other
+* thread pops.
+*
+* When the ring is full new events are dropped and the overflow is recorded,
+* so the consumer knows to rescan. An event identical to the newest one not
+* yet popped is coalesced into it instead of taking a second slot; the
+* producer compares against its own copy of that event, never the slot,
+* which the consumer may be swapping out at the same moment. If that pop
+* races the merge, the consumer has just taken an identical event, so
+* nothing it needs to know is lost.
+*
+* Slots keep the capacity of their strings: push() assigns into a slot and
+* pop() swaps the slot with the caller's event. A consumer that pops into
+* the same FSEvent each time therefore hands buffers back to the ring, and
+* once they have grown to the usual path length neither side allocates.
+*/
+class FSEventQueue
+{
+public:
+
+	/*
+	* @param capacity Number of slots, rounded up to a power of two.
+	*/
+	FSEventQueue(std::size_t capacity = 1024);
+
+	FSEventQueue(const FSEventQueue&) = delete;
+	FSEventQueue& operator=(const FSEventQueue&) = delete;
+
+	/*
+	* push() adds an event. Producer side only.
+	*
+	* @return false if the event was dropped because the ring is full.
+	*/
+	bool push(const FSEvent& event);
+
+	/*
+	* pop() removes the oldest event. Consumer side only.
+	*
+	* @param event Receives the event. Its previous strings are given to the
+	*              ring for reuse.
+	* @return false if the queue is empty.
+	*/
+	bool pop(FSEvent& event);
+
+	/*
+	* takeOverflow() reports whether events were dropped since the last call
+	* and resets the flag. Consumer side only.
+	*/
+	bool takeOverflow();
+
+	/*
+	* @return Total events dropped because the ring was full.
+	*/
+	std::size_t getDroppedCount() const;
+
+	/*
+	* @return Total events merged into an identical pending event.
+	*/
+	std::size_t getCoalescedCount() const;
+
+private:
+	std::vector<FSEvent> slots;
+	std::size_t mask; // slots.size() - 1
+
+	// Ever-increasing positions. head is written only by the consumer,
+	// tail only by the producer; each sits on its own cache line.
+	alignas(64) std::atomic<std::size_t> head;
+	alignas(64) std::atomic<std::size_t> tail;
+
+	std::atomic<bool> overflowed;
+	std::atomic<std::size_t> droppedCount;
+	std::atomic<std::size_t> coalescedCount;
+
+	FSEvent lastPushed; // producer side only, copy of the newest pushed event
+
+}; // end FSEventQueue
+
+#endif
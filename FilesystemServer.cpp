@@ -0,0 +1,411 @@
+#include "FilesystemServer.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const int MAX_EVENTS = 64; // epoll events handled per wakeup
+const std::size_t READ_CHUNK = 64 * 1024;
+
+// Most bytes read from one client per wakeup, so one client cannot starve
+// the others
+const std::size_t READ_BUDGET = 16 * READ_CHUNK;
+
+// A client with this many response bytes unsent is not read from (and its
+// queued requests are not executed) until it reads some of them
+const std::size_t MAX_PENDING_OUTPUT = 4 * 1024 * 1024;
+
+FilesystemServer::FilesystemServer(FilesystemTree& pTree,
+	const std::string& pSocketPath)
+	: tree(pTree), socketPath(pSocketPath), listenFd(-1), epollFd(-1),
+	wakeFd(-1), requestCount(0), batchCount(0)
+{
+	sockaddr_un address;
+	epoll_event event;
+
+	if (socketPath.length() >= sizeof(address.sun_path))
+	{
+		throw std::runtime_error("Socket path " + socketPath + " is too long.");
+	}
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (listenFd < 0 || epollFd < 0 || wakeFd < 0)
+	{
+		closeAll();
+		throw std::runtime_error(std::string("Socket setup failed: ")
+			+ std::strerror(errno));
+	}
+
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strcpy(address.sun_path, socketPath.c_str());
+	unlink(socketPath.c_str()); // remove a socket left by a previous run
+
+	if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+		|| listen(listenFd, SOMAXCONN) < 0)
+	{
+		std::string error = std::strerror(errno);
+		closeAll();
+		throw std::runtime_error("Could not listen on " + pSocketPath + ": " + error);
+	}
+
+	event.events = EPOLLIN;
+	event.data.fd = listenFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+	event.events = EPOLLIN;
+	event.data.fd = wakeFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+} // end constructor
+
+void FilesystemServer::run()
+{
+	epoll_event events[MAX_EVENTS];
+	bool running = true;
+
+	while (running)
+	{
+		int count = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+
+		if (count < 0 && errno != EINTR)
+		{
+			running = false;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			int fd = events[i].data.fd;
+
+			if (fd == wakeFd)
+			{
+				running = false;
+			}
+			else if (fd == listenFd)
+			{
+				acceptClients();
+			}
+			else if (clients.count(fd) > 0)
+			{
+				if (!serveClient(fd, clients[fd], events[i].events))
+				{
+					closeClient(fd);
+				}
+			}
+		}
+	}
+} // end run
+
+void FilesystemServer::stop()
+{
+	std::uint64_t one = 1;
+
+	// write() on an eventfd is async-signal-safe
+	if (write(wakeFd, &one, sizeof(one)) < 0)
+	{
+		// counter already non-zero, run() will wake up anyway
+	}
+} // end stop
+
+std::size_t FilesystemServer::getRequestCount() const
+{
+	return requestCount;
+} // end getRequestCount
+
+std::size_t FilesystemServer::getBatchCount() const
+{
+	return batchCount;
+} // end getBatchCount
+
+void FilesystemServer::acceptClients()
+{
+	int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+	while (fd >= 0)
+	{
+		epoll_event event;
+
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = fd;
+
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0)
+		{
+			clients[fd] = Connection();
+			clients[fd].events = event.events;
+		}
+		else
+		{
+			close(fd);
+		}
+
+		fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	}
+} // end acceptClients
+
+bool FilesystemServer::serveClient(int fd, Connection& client, std::uint32_t events)
+{
+	bool alive = !(events & (EPOLLERR | EPOLLHUP)) || (events & EPOLLIN);
+	bool progress = true;
+
+	if (alive && (events & EPOLLIN))
+	{
+		// Read everything first so that all pipelined requests are
+		// executed as one batch with one write.
+		alive = readClient(fd, client);
+	}
+
+	// Requests held back by a full output buffer run once it drains, even
+	// if the client sends nothing more.
+	while (progress)
+	{
+		std::size_t pending = client.inBuffer.size();
+
+		alive = processFrames(client) && alive;
+		if (alive || !client.outBuffer.empty())
+		{
+			alive = flushClient(fd, client) && alive;
+		}
+
+		progress = alive && client.inBuffer.size() < pending
+			&& client.outBuffer.size() < MAX_PENDING_OUTPUT;
+	}
+
+	if (alive)
+	{
+		updateEvents(fd, client);
+	}
+
+	return alive;
+} // end serveClient
+
+bool FilesystemServer::readClient(int fd, Connection& client)
+{
+	bool rValue = true;
+	bool draining = true;
+	std::size_t budget = READ_BUDGET;
+
+	while (draining && budget > 0)
+	{
+		std::size_t oldSize = client.inBuffer.size();
+		client.inBuffer.resize(oldSize + READ_CHUNK);
+
+		ssize_t bytes = read(fd, &client.inBuffer[oldSize], READ_CHUNK);
+		client.inBuffer.resize(oldSize + (bytes > 0 ? bytes : 0));
+
+		if (bytes == 0)
+		{
+			draining = false;
+			rValue = false; // orderly shutdown by the client
+		}
+		else if (bytes < 0)
+		{
+			draining = false;
+			rValue = (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+		}
+		else if (static_cast<std::size_t>(bytes) < READ_CHUNK)
+		{
+			draining = false; // socket is empty, skip the EAGAIN round trip
+		}
+		else
+		{
+			budget -= READ_CHUNK;
+		}
+	}
+
+	return rValue;
+} // end readClient
+
+bool FilesystemServer::processFrames(Connection& client)
+{
+	std::size_t pos = 0;
+	std::size_t executed = 0;
+	bool rValue = true;
+
+	while (rValue && client.inBuffer.size() - pos >= FRAME_HEADER_SIZE
+		&& client.outBuffer.size() < MAX_PENDING_OUTPUT)
+	{
+		std::uint32_t bodySize = peekFrameSize(client.inBuffer.data() + pos);
+
+		if (bodySize > MAX_FRAME_SIZE)
+		{
+			rValue = false;
+		}
+		else if (client.inBuffer.size() - pos - FRAME_HEADER_SIZE < bodySize)
+		{
+			break; // rest of the frame has not arrived yet
+		}
+		else
+		{
+			executeRequest(client.inBuffer.data() + pos + FRAME_HEADER_SIZE,
+				bodySize, client.outBuffer);
+			pos += FRAME_HEADER_SIZE + bodySize;
+			executed++;
+		}
+	}
+
+	// Drop the consumed frames in one go rather than one at a time
+	client.inBuffer.erase(0, pos);
+
+	if (executed > 0)
+	{
+		requestCount += executed;
+		batchCount++;
+	}
+
+	return rValue;
+} // end processFrames
+
+bool FilesystemServer::flushClient(int fd, Connection& client)
+{
+	std::size_t written = 0;
+	bool rValue = true;
+
+	while (rValue && written < client.outBuffer.size())
+	{
+		ssize_t bytes = send(fd, client.outBuffer.data() + written,
+			client.outBuffer.size() - written, MSG_NOSIGNAL);
+
+		if (bytes > 0)
+		{
+			written += bytes;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			break; // kernel buffer full, wait for EPOLLOUT
+		}
+		else if (errno != EINTR)
+		{
+			rValue = false;
+		}
+	}
+
+	client.outBuffer.erase(0, written);
+
+	return rValue;
+} // end flushClient
+
+void FilesystemServer::updateEvents(int fd, Connection& client)
+{
+	std::uint32_t wanted = 0;
+
+	// EPOLLRDHUP goes with EPOLLIN: it stays raised once the client shuts
+	// down its side, and would spin the loop while input is paused.
+	if (client.outBuffer.size() < MAX_PENDING_OUTPUT)
+	{
+		wanted |= EPOLLIN | EPOLLRDHUP;
+	}
+	if (!client.outBuffer.empty())
+	{
+		wanted |= EPOLLOUT;
+	}
+
+	if (wanted != client.events)
+	{
+		epoll_event event;
+
+		event.events = wanted;
+		event.data.fd = fd;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+		client.events = wanted;
+	}
+} // end updateEvents
+
+void FilesystemServer::executeRequest(const char* body, std::uint32_t bodySize,
+	std::string& out)
+{
+	FSFrameReader reader(body, bodySize);
+	std::uint8_t opcode = 0;
+	std::uint8_t type = 0;
+	std::string name;
+	std::string path;
+	std::string destPath;
+	std::ostringstream text;
+	std::uint8_t status = STATUS_OK;
+	std::uint32_t result = 0;
+
+	reader.readU8(opcode);
+
+	if (opcode == OP_CREATE && reader.readU8(type) && reader.readString(name)
+		&& reader.readString(path) && reader.atEnd()
+		&& (type == DIR_TYPE || type == FILE_TYPE))
+	{
+		result = tree.create(name, type, path);
+	}
+	else if (opcode == OP_REMOVE && reader.readString(name)
+		&& reader.readString(path) && reader.atEnd())
+	{
+		result = tree.remove(name, path);
+	}
+	else if ((opcode == OP_MOVE || opcode == OP_COPY) && reader.readString(name)
+		&& reader.readString(path) && reader.readString(destPath)
+		&& reader.atEnd())
+	{
+		result = (opcode == OP_MOVE) ? tree.move(name, path, destPath)
+			: tree.copy(name, path, destPath);
+	}
+	else if (opcode == OP_FIND && reader.readString(name)
+		&& reader.readString(path) && reader.atEnd())
+	{
+		result = tree.find(name, path, text);
+	}
+	else if (opcode == OP_STATS && reader.atEnd())
+	{
+		tree.displayStats(text);
+	}
+	else
+	{
+		status = STATUS_BAD_REQUEST;
+	}
+
+	std::size_t frameStart = beginFrame(out);
+	appendU8(out, status);
+	appendU32(out, result);
+	appendText(out, text.str());
+	endFrame(out, frameStart);
+} // end executeRequest
+
+void FilesystemServer::closeClient(int fd)
+{
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	close(fd);
+	clients.erase(fd);
+} // end closeClient
+
+FilesystemServer::~FilesystemServer()
+{
+	closeAll();
+} // end destructor
+
+void FilesystemServer::closeAll()
+{
+	for (auto& client : clients)
+	{
+		close(client.first);
+	}
+	clients.clear();
+
+	if (listenFd >= 0)
+	{
+		close(listenFd);
+		unlink(socketPath.c_str());
+		listenFd = -1;
+	}
+	if (epollFd >= 0)
+	{
+		close(epollFd);
+		epollFd = -1;
+	}
+	if (wakeFd >= 0)
+	{
+		close(wakeFd);
+		wakeFd = -1;
+	}
+} // end closeAll
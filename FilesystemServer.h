@@ -0,0 +1,137 @@
+#ifndef FILESYSTEMSERVER
+#define FILESYSTEMSERVER
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include "FilesystemTree.h"
+#include "FSProtocol.h"
+
+/*
+* FilesystemServer serves a single FilesystemTree to many local processes
+* over a Unix domain socket, so the tree is loaded and held in memory once.
+*
+* The server is a single-threaded epoll event loop, so the tree itself needs
+* no locking. Clients may pipeline: every frame that has arrived on a
+* connection is executed as one batch and all of the responses are sent back
+* with a single write, in request order.
+*/
+class FilesystemServer
+{
+public:
+
+	/*
+	* Constructor which binds and listens on the socket. Any stale socket file
+	* at socketPath is removed first.
+	*
+	* @param pTree The tree to serve. Must outlive the server.
+	* @param pSocketPath File system path of the Unix domain socket.
+	*/
+	FilesystemServer(FilesystemTree& pTree, const std::string& pSocketPath);
+
+	/*
+	* run() processes client requests until stop() is called.
+	*/
+	void run();
+
+	/*
+	* stop() makes run() return. Safe to call from another thread or from a
+	* signal handler.
+	*/
+	void stop();
+
+	/*
+	* @return The number of requests executed so far.
+	*/
+	std::size_t getRequestCount() const;
+
+	/*
+	* @return The number of batches executed so far. requests / batches is the
+	*         average batch size.
+	*/
+	std::size_t getBatchCount() const;
+
+	~FilesystemServer();
+
+private:
+
+	// Per client state. Input is kept until a whole frame has arrived and
+	// output until the socket accepts it.
+	struct Connection
+	{
+		std::string inBuffer;
+		std::string outBuffer;
+		std::uint32_t events = 0; // epoll events currently registered
+	};
+
+	/*
+	* acceptClients() accepts every pending connection on the listening socket.
+	*/
+	void acceptClients();
+
+	/*
+	* serveClient() handles one epoll wakeup for a client: reads, executes
+	* and writes as far as the backpressure limits allow.
+	*
+	* @return false if the connection should be closed.
+	*/
+	bool serveClient(int fd, Connection& client, std::uint32_t events);
+
+	/*
+	* readClient() reads what the socket holds into the connection's input
+	* buffer, at most READ_BUDGET bytes per call. Epoll reports the rest on
+	* the next wakeup.
+	*
+	* @return false if the client closed the connection or an error occurred.
+	*/
+	bool readClient(int fd, Connection& client);
+
+	/*
+	* processFrames() executes the complete frames in the input buffer and
+	* appends the responses to the output buffer, stopping once that holds
+	* MAX_PENDING_OUTPUT bytes.
+	*
+	* @return false if the client sent an oversized frame.
+	*/
+	bool processFrames(Connection& client);
+
+	/*
+	* flushClient() writes as much of the output buffer as the socket accepts.
+	*
+	* @return false if the write failed.
+	*/
+	bool flushClient(int fd, Connection& client);
+
+	/*
+	* updateEvents() registers interest in EPOLLOUT while output is pending,
+	* and drops EPOLLIN while the output buffer is over MAX_PENDING_OUTPUT so
+	* a client that does not read its responses stops being read from.
+	*/
+	void updateEvents(int fd, Connection& client);
+
+	/*
+	* executeRequest() decodes one request body, runs it against the tree and
+	* appends the response frame to out.
+	*/
+	void executeRequest(const char* body, std::uint32_t bodySize,
+		std::string& out);
+
+	void closeClient(int fd);
+
+	/*
+	* closeAll() closes every descriptor and removes the socket file.
+	*/
+	void closeAll();
+
+	FilesystemTree& tree;
+	std::string socketPath;
+	int listenFd;
+	int epollFd;
+	int wakeFd; // eventfd used by stop() to interrupt epoll_wait
+	std::unordered_map<int, Connection> clients;
+	std::size_t requestCount;
+	std::size_t batchCount;
+
+}; // end FilesystemServer
+
+#endif
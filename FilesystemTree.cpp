@@ -4,13 +4,167 @@
 **/
 
 #include "FilesystemTree.h"
+#include "FSThreadPool.h"
+#include <algorithm>
+#include <cstdio>
+#include <exception>
 #include <fstream>
 #include <stdexcept>
 
+// Subtrees with at least this many nodes are copied on the thread pool
+const int PARALLEL_COPY_THRESHOLD = 4096;
+
+// How many levels below the copied node may be split into separate tasks
+const int PARALLEL_COPY_LEVELS = 3;
+
+// Stale subtree filters are refreshed after this many removals, starting
+// from the root if its filter is this full
+const int FILTER_REFRESH_REMOVALS = 1024;
+const double FILTER_REBUILD_FILL = 0.5;
+
+// Subtrees with at least this many nodes are exported as separate chunks
+const int EXPORT_CHUNK_NODES = 8192;
+
+// How many levels below the exported node may be split into chunks
+const int EXPORT_SPLIT_LEVELS = 3;
+
+namespace
+{
+	// Appends value as a quoted JSON string
+	void appendJson(std::string& buffer, const std::string& value)
+	{
+		buffer += '"';
+		for (char c : value)
+		{
+			if (c == '"' || c == '\\')
+			{
+				buffer += '\\';
+				buffer += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				const char* hex = "0123456789abcdef";
+				buffer += "\\u00";
+				buffer += hex[(c >> 4) & 0xF];
+				buffer += hex[c & 0xF];
+			}
+			else
+			{
+				buffer += c;
+			}
+		}
+		buffer += '"';
+	}
+
+	// Allocator that remembers the size of its last allocation. It holds no
+	// state, so shared_ptr control blocks made with it are laid out exactly
+	// like those made by make_shared.
+	std::size_t probedBytes = 0;
+
+	template <typename T>
+	struct SizeProbe
+	{
+		typedef T value_type;
+
+		SizeProbe() = default;
+		template <typename U> SizeProbe(const SizeProbe<U>&) {}
+
+		T* allocate(std::size_t n)
+		{
+			probedBytes = n * sizeof(T);
+			return std::allocator<T>().allocate(n);
+		}
+
+		void deallocate(T* p, std::size_t n)
+		{
+			std::allocator<T>().deallocate(p, n);
+		}
+
+		template <typename U> bool operator==(const SizeProbe<U>&) const { return true; }
+		template <typename U> bool operator!=(const SizeProbe<U>&) const { return false; }
+	};
+
+	// Bytes of one make_shared<FSNode>() allocation: node plus control block
+	std::size_t nodeHeaderBytes()
+	{
+		static const std::size_t bytes = []()
+		{
+			std::allocate_shared<FSNode>(SizeProbe<FSNode>(), "", FILE_TYPE);
+			return probedBytes;
+		}();
+
+		return bytes;
+	}
+
+	// Bytes of one allocate_shared<FSNode>() allocation in an FSArena, whose
+	// control block also holds the allocator
+	std::size_t arenaNodeHeaderBytes()
+	{
+		static const std::size_t bytes = []()
+		{
+			FSArena* arena = new FSArena();
+			std::shared_ptr<FSNode> probe = std::allocate_shared<FSNode>(
+				FSArenaAllocator<FSNode>(arena), "", FILE_TYPE);
+			std::size_t used = arena->getBytesUsed();
+
+			probe = nullptr;
+			arena->release();
+			return used;
+		}();
+
+		return bytes;
+	}
+
+	// Bytes a string keeps on the heap, 0 while it fits in the string itself
+	std::size_t nameHeapBytes(const std::string& name)
+	{
+		const char* inlineStart = reinterpret_cast<const char*>(&name);
+		bool isInline = name.data() >= inlineStart
+			&& name.data() < inlineStart + sizeof(name);
+
+		return isInline ? 0 : name.capacity() + 1;
+	}
+
+	// Child slots an array keeps on the heap, 0 while they are in the node
+	template <typename T>
+	std::size_t childHeapSlots(const std::vector<T>& children)
+	{
+		return children.capacity();
+	}
+
+	template <typename T, std::size_t N>
+	std::size_t childHeapSlots(const FSInlineVector<T, N>& children)
+	{
+		return children.isInline() ? 0 : children.capacity();
+	}
+
+	// Appends value as a CSV field, quoted only when it has to be
+	void appendCsv(std::string& buffer, const std::string& value)
+	{
+		if (value.find_first_of(",\"\r\n") == std::string::npos)
+		{
+			buffer += value;
+		}
+		else
+		{
+			buffer += '"';
+			for (char c : value)
+			{
+				buffer += c;
+				if (c == '"')
+				{
+					buffer += '"';
+				}
+			}
+			buffer += '"';
+		}
+	}
+}
 
 bool FilesystemTree::create(const std::string& pName, int pType,
 	const std::string& parentPath)
 {
+	std::chrono::steady_clock::time_point start = traceBegin();
 	bool rValue = false;
 
 	//make a node named pName of type pType.
@@ -18,167 +172,1231 @@ bool FilesystemTree::create(const std::string& pName, int pType,
 	//make another node at the path parentPath.
 	std::shared_ptr<FSNode> parentPtr = pathToPointer(parentPath);
 
-	if (pName != ROOT_NAME && pName != parentPtr->getName())
+	if (pName != ROOT_NAME && parentPtr != nullptr 
+		&& pName != parentPtr->getName())
 	{
 		//add a child node to the parent node.
-		parentPtr->addChild(newNodePtr);
-
 		//returns true if the node was successfully added.
+		rValue = parentPtr->addChild(newNodePtr);
+		parentPtr->dirty = parentPtr->dirty || rValue;
+	}
+
+	if (rValue)
+	{
+		updateFilters(parentPath, newNodePtr);
+		publish(EVENT_CREATE, newNodePtr->getName(), parentPath, "");
+	}
+
+	traceEnd(start, TRACE_CREATE, rValue, pType, pName, parentPath);
+	
+	return rValue;
+}
+
+bool FilesystemTree::remove(const std::string& pName, const std::string& parentPath)
+{
+	std::chrono::steady_clock::time_point start = traceBegin();
+	bool rValue = false;
+
+	//make a node at the path parentPath.
+	std::shared_ptr<FSNode> parentPtr = pathToPointer(parentPath);
+
+	//remove the node named pName from the directory at the path parentPath. 
+	if (pName != ROOT_NAME && parentPtr != nullptr && parentPtr->removeChild(pName))
+	{
+		//Returns true if the node was successfully removed.
 		rValue = true;
+		parentPtr->dirty = true;
+		updateFilters(parentPath, nullptr);
+		publish(EVENT_REMOVE, FSNode::cleanName(pName), parentPath, "");
+	}
+
+	traceEnd(start, TRACE_REMOVE, rValue, 0, pName, parentPath);
+
+	return rValue;
+}
+
+
+bool FilesystemTree::move(const std::string& pName, const std::string& sourcePath,
+	const std::string& destPath)
+{
+	std::chrono::steady_clock::time_point start = traceBegin();
+	bool rValue = false;
+	
+	//make a node at the path sourcePath.
+	std::shared_ptr<FSNode> sourceParentPtr = pathToPointer(sourcePath);
+	//make a node at the path destPath, remembering the directories above it.
+	std::vector<std::shared_ptr<FSNode>> destChain;
+	std::shared_ptr<FSNode> destParentPtr = pathToPointer(destPath, &destChain);
+
+	//should not allow the root node to be moved.
+	//if pName is a name of a directory, it moves the directory.
+	if (pName != ROOT_NAME 
+		&& sourceParentPtr != nullptr 
+		&& destParentPtr != nullptr 
+		&& nullptr != sourceParentPtr->getChild(pName))
+	{
+		//move the node named pName from the directory at the path sourcePath, 
+		std::shared_ptr<FSNode> moveNode = sourceParentPtr->getChild(pName);
+
+		//to the directory at destPath, unless that is inside moveNode itself.
+		if (std::find(destChain.begin(), destChain.end(), moveNode) == destChain.end()
+			&& destParentPtr->addChild(moveNode))
+		{
+			//remove the child from the directory at the path sourcePath.
+			sourceParentPtr->removeChild(pName);
+			sourceParentPtr->dirty = true;
+			destParentPtr->dirty = true;
+			updateFilters(sourcePath, nullptr);
+			updateFilters(destPath, moveNode);
+			publish(EVENT_MOVE, moveNode->getName(), sourcePath, destPath);
+
+			//Returns true if the move was successful.
+			rValue = true;
+		}
+	}
+
+	traceEnd(start, TRACE_MOVE, rValue, 0, pName, sourcePath, destPath);
+
+	return rValue;
+}
+
+std::shared_ptr<FSNode> FilesystemTree::copySubTree(std::shared_ptr<FSNode> rootPtr) const
+{
+	std::shared_ptr<FSNode> rPtr = nullptr;
+
+	if (rootPtr != nullptr)
+	{
+		if (!FS_USE_THREADS || FSThreadPool::shared().getThreadCount() < 2
+			|| countAtLeast(rootPtr, PARALLEL_COPY_THRESHOLD) < PARALLEL_COPY_THRESHOLD)
+		{
+			//small subtrees are not worth handing to other threads
+			rPtr = copySerial(rootPtr);
+		}
+		else
+		{
+			std::vector<std::future<void>> tasks;
+			std::exception_ptr failure = nullptr;
+
+			try
+			{
+				rPtr = copySplit(rootPtr, PARALLEL_COPY_LEVELS, tasks);
+			}
+			catch (...)
+			{
+				failure = std::current_exception();
+			}
+
+			//wait for every subtree copied on the pool, even after a failure,
+			//so no task is left writing into a copy that is being freed
+			for (std::future<void>& task : tasks)
+			{
+				try
+				{
+					task.get();
+				}
+				catch (...)
+				{
+					if (failure == nullptr)
+					{
+						failure = std::current_exception();
+					}
+				}
+			}
+
+			if (failure != nullptr)
+			{
+				std::rethrow_exception(failure);
+			}
+		}
+	}
+
+	//Returns a fully independent copy of the subtree which begins at rootPtr. 
+	return rPtr;
+
+}
+
+std::shared_ptr<FSNode> FilesystemTree::cloneNode(const std::shared_ptr<FSNode>& nodePtr) const
+{
+	//copy node. The name is assigned directly so that a copy of the root
+	//keeps ROOT_NAME.
+	std::shared_ptr<FSNode> rPtr = std::make_shared<FSNode>("", nodePtr->type);
+	rPtr->name = nodePtr->name;
+
+	//an unvisited snapshot directory is copied by sharing its record
+	rPtr->imageOffset = nodePtr->imageOffset;
+
+	//the copied subtree has the same names, so the same filter
+	if (nodePtr->subtreeFilter != nullptr)
+	{
+		rPtr->subtreeFilter.reset(new FSBloomFilter(*nodePtr->subtreeFilter));
+	}
+	else
+	{
+		rPtr->subtreeFilter.reset();
+	}
+	rPtr->filterStale = nodePtr->filterStale;
+
+	return rPtr;
+}
+
+std::shared_ptr<FSNode> FilesystemTree::copySerial(const std::shared_ptr<FSNode>& nodePtr) const
+{
+	std::shared_ptr<FSNode> rPtr = cloneNode(nodePtr);
+
+	//children are already sorted and unique, append them in order
+	rPtr->children.reserve(nodePtr->children.size());
+	for (const std::shared_ptr<FSNode>& childPtr : nodePtr->children)
+	{
+		rPtr->children.push_back(copySerial(childPtr));
+	}
+
+	return rPtr;
+}
+
+std::shared_ptr<FSNode> FilesystemTree::copySplit(const std::shared_ptr<FSNode>& nodePtr,
+	int levels, std::vector<std::future<void>>& tasks) const
+{
+	std::shared_ptr<FSNode> rPtr = cloneNode(nodePtr);
+	int childCount = nodePtr->children.size();
+	int runStart = 0;
+	int runSize = 0;
+
+	//size the array up front: from here on every thread, this one
+	//included, only assigns to its own slots
+	rPtr->children.resize(childCount);
+
+	//copies children [runStart, end) into their slots, on the pool if the
+	//run is large enough
+	auto flushRun = [&](int end)
+	{
+		std::shared_ptr<FSNode> sourcePtr = nodePtr;
+		std::shared_ptr<FSNode> targetPtr = rPtr; //kept alive by the task
+		int begin = runStart;
+		auto copyRun = [this, sourcePtr, targetPtr, begin, end]()
+		{
+			for (int i = begin; i < end; i++)
+			{
+				targetPtr->children[i] = copySerial(sourcePtr->children[i]);
+			}
+		};
+
+		if (runSize >= PARALLEL_COPY_THRESHOLD)
+		{
+			tasks.push_back(FSThreadPool::shared().submit(copyRun));
+		}
+		else
+		{
+			copyRun();
+		}
+
+		runStart = end;
+		runSize = 0;
+	};
+
+	for (int i = 0; i < childCount; i++)
+	{
+		const std::shared_ptr<FSNode>& childPtr = nodePtr->children[i];
+		int childSize = countAtLeast(childPtr, PARALLEL_COPY_THRESHOLD);
+
+		if (levels > 0 && childSize >= PARALLEL_COPY_THRESHOLD)
+		{
+			//large directory, split it further on this thread
+			flushRun(i);
+			rPtr->children[i] = copySplit(childPtr, levels - 1, tasks);
+			runStart = i + 1;
+		}
+		else
+		{
+			//slot is filled in when the run is flushed
+			runSize += childSize;
+
+			if (runSize >= PARALLEL_COPY_THRESHOLD)
+			{
+				flushRun(i + 1);
+			}
+		}
+	}
+	flushRun(childCount);
+
+	return rPtr;
+}
+
+int FilesystemTree::countAtLeast(const std::shared_ptr<FSNode>& nodePtr, int limit) const
+{
+	int count = 1;
+
+	for (unsigned int i = 0; i < nodePtr->children.size() && count < limit; i++)
+	{
+		count += countAtLeast(nodePtr->children[i], limit - count);
+	}
+
+	return count < limit ? count : limit;
+}
+
+bool FilesystemTree::copy(const std::string& pName, const std::string& sourcePath,
+	const std::string& destPath)
+{
+	std::chrono::steady_clock::time_point start = traceBegin();
+	bool rValue = false;
+
+	//make a node at the path sourcePath.
+	std::shared_ptr<FSNode> sourceParentPtr = pathToPointer(sourcePath);
+	//make a node at the path destPath.
+	std::shared_ptr<FSNode> destParentPtr = pathToPointer(destPath);
+
+	//should not allow the root node to be copied.
+	//if pName is a name of a directory it copies the directory.
+	if (pName != ROOT_NAME 
+		&& sourceParentPtr != nullptr 
+		&& destParentPtr != nullptr 
+		&& nullptr != sourceParentPtr->getChild(pName)) 
+	{
+		//copy the node named pName from the directory at the path sourcePath,
+		std::shared_ptr<FSNode> copyNode = copySubTree(sourceParentPtr->getChild(pName));
+
+		//to the directory at destPath. 
+		if (destParentPtr->addChild(copyNode)) 
+		{
+			//Returns true if the copy was successful.
+			rValue = true;
+			destParentPtr->dirty = true;
+			updateFilters(destPath, copyNode);
+			publish(EVENT_COPY, copyNode->getName(), sourcePath, destPath);
+		}
+	}
+
+	traceEnd(start, TRACE_COPY, rValue, 0, pName, sourcePath, destPath);
+
+	return rValue;
+}
+
+
+
+
+/***********************************************************************/
+/************* YOU SHOULD NOT NEED TO EDIT BELOW THIS LINE *************/
+/***********************************************************************/
+
+int FilesystemTree::find(const std::string& pName, const std::string& startPath,
+	std::ostream& outStream) const
+{
+	std::chrono::steady_clock::time_point start = traceBegin();
+	int matches = 0;  // no results found
+	std::shared_ptr<FSNode> nodePtr = pathToPointer(startPath);
+	std::string foldedName;
+	const std::string* namePtr = &pName;
+
+	if (FSNamePolicy::FOLDS_CASE)
+	{
+		foldedName = pName;
+		FSNode::foldName(foldedName);
+		namePtr = &foldedName;
+	}
+
+	// Nothing below startPath can match if its subtree filter says so
+	if (nodePtr != nullptr && nodePtr->isDirectory()
+		&& mightContainBelow(nodePtr, FSBloomFilter::hashName(*namePtr)))
+	{
+		std::string path = startPath;
+		matches = recursiveFind(nodePtr, *namePtr, FSBloomFilter::hashName(*namePtr),
+			path, outStream);
+	}
+
+	traceEnd(start, TRACE_FIND, matches, 0, pName, startPath);
+
+	return matches;
+
+}
+
+int FilesystemTree::recursiveFind(const std::shared_ptr<FSNode>& nodePtr,
+	const std::string& pName, std::uint64_t nameHash, std::string& path,
+	std::ostream& outStream) const
+{
+	int matches = 0;
+	std::size_t pathLength = path.length();
+
+	hydrate(nodePtr);
+
+	for (int i = 0; i < nodePtr->getNumChildren(); i++)
+	{
+		if (pName == nodePtr->getChild(i)->getName())
+		{
+			outStream << path + SEPARATING_CHAR + pName << std::endl;
+			matches++;
+		}
+	}
+
+	// recurse subdirectories
+	for (int i = 0; i < nodePtr->getNumChildren(); i++)
+	{
+		std::shared_ptr<FSNode> childPtr = nodePtr->getChild(i);
+
+		if (childPtr->isDirectory() && mightContainBelow(childPtr, nameHash))
+		{
+			path += SEPARATING_CHAR;
+			path += childPtr->getName();
+			matches += recursiveFind(childPtr, pName, nameHash, path, outStream);
+			path.resize(pathLength);
+		}
+	}
+
+	return matches;
+}
+
+FSListPage FilesystemTree::list(const std::string& path, const std::string& pPrefix,
+	const std::string& pStartAfter, int limit) const
+{
+	std::chrono::steady_clock::time_point start = traceBegin();
+	FSListPage page;
+	std::shared_ptr<FSNode> nodePtr = pathToPointer(path);
+	std::string prefix = pPrefix;
+	std::string startAfter = pStartAfter;
+
+	FSNode::foldName(prefix);
+	FSNode::foldName(startAfter);
+
+	if (nodePtr != nullptr && nodePtr->isDirectory() && limit > 0)
+	{
+		// First candidate: the first name >= prefix, or the first name after 
+		// the cursor if that lies further on.
+		int pos = nodePtr->lowerBound(prefix);
+
+		if (startAfter >= prefix)
+		{
+			pos = nodePtr->lowerBound(startAfter);
+			if (pos < nodePtr->getNumChildren() 
+				&& nodePtr->children[pos]->name == startAfter)
+			{
+				pos++;
+			}
+		}
+
+		// Names with the prefix are contiguous in sorted order
+		while (pos < nodePtr->getNumChildren()
+			&& nodePtr->children[pos]->name.compare(0, prefix.length(), prefix) == 0
+			&& static_cast<int>(page.names.size()) < limit)
+		{
+			page.names.push_back(nodePtr->children[pos]->name);
+			page.types.push_back(nodePtr->children[pos]->type);
+			pos++;
+		}
+
+		page.hasMore = pos < nodePtr->getNumChildren()
+			&& nodePtr->children[pos]->name.compare(0, prefix.length(), prefix) == 0;
+		page.cursor = page.names.empty() ? startAfter : page.names.back();
+	}
+
+	traceEnd(start, TRACE_LIST, page.names.size(), limit, pPrefix, path, pStartAfter);
+
+	return page;
+}
+
+bool FilesystemTree::exportTree(const std::string& path, int format,
+	std::ostream& outStream) const
+{
+	std::chrono::steady_clock::time_point start = traceBegin();
+	std::shared_ptr<FSNode> nodePtr = pathToPointer(path);
+	std::string nodePath = path;
+
+	if (nodePtr == nullptr 
+		|| (format != EXPORT_JSON && format != EXPORT_NDJSON && format != EXPORT_CSV))
+	{
+		traceEnd(start, TRACE_EXPORT, false, format, "", path);
+		return false;
+	}
+
+	// Report the path the same way find() does
+	if (nodePath.length() > ROOT_NAME.length() 
+		&& nodePath[nodePath.length() - 1] == SEPARATING_CHAR)
+	{
+		nodePath.erase(nodePath.length() - 1);
+	}
+
+	std::deque<ExportPiece> pieces(1);
+	std::exception_ptr failure = nullptr;
+
+	if (format == EXPORT_CSV)
+	{
+		pieces.back().text = "path,name,type\n";
+	}
+
+	if (!FS_USE_THREADS || FSThreadPool::shared().getThreadCount() < 2
+		|| countAtLeast(nodePtr, EXPORT_CHUNK_NODES) < EXPORT_CHUNK_NODES)
+	{
+		exportSerial(nodePtr, nodePath, format, true, pieces.back().text);
+	}
+	else
+	{
+		try
+		{
+			exportSplit(nodePtr, nodePath, format, true, EXPORT_SPLIT_LEVELS, pieces);
+		}
+		catch (...)
+		{
+			failure = std::current_exception();
+		}
+	}
+
+	if (format == EXPORT_JSON)
+	{
+		pieces.back().text += '\n';
+	}
+
+	// Write each piece straight from its buffer as soon as it is complete.
+	// After a failure the remaining chunks are still waited for, as their
+	// tasks write into pieces.
+	for (ExportPiece& piece : pieces)
+	{
+		if (piece.done.valid())
+		{
+			try
+			{
+				piece.done.get();
+			}
+			catch (...)
+			{
+				if (failure == nullptr)
+				{
+					failure = std::current_exception();
+				}
+			}
+		}
+		if (failure == nullptr)
+		{
+			outStream.write(piece.text.data(), piece.text.size());
+		}
+	}
+
+	if (failure != nullptr)
+	{
+		std::rethrow_exception(failure);
+	}
+
+	traceEnd(start, TRACE_EXPORT, !outStream.fail(), format, "", path);
+
+	return !outStream.fail();
+}
+
+void FilesystemTree::exportSerial(const std::shared_ptr<FSNode>& nodePtr,
+	std::string& path, int format, bool first, std::string& buffer) const
+{
+	exportOpen(nodePtr, path, format, first, buffer);
+
+	if (nodePtr->isDirectory())
+	{
+		std::size_t pathLength = path.length();
+
+		hydrate(nodePtr);
+
+		// Extend one path in place rather than building a new one per node
+		for (unsigned int i = 0; i < nodePtr->children.size(); i++)
+		{
+			const std::shared_ptr<FSNode>& childPtr = nodePtr->children[i];
+
+			path += SEPARATING_CHAR;
+			path += childPtr->name;
+			exportSerial(childPtr, path, format, i == 0, buffer);
+			path.resize(pathLength);
+		}
+	}
+
+	exportClose(nodePtr, format, buffer);
+}
+
+void FilesystemTree::exportSplit(const std::shared_ptr<FSNode>& nodePtr,
+	const std::string& path, int format, bool first, int levels,
+	std::deque<ExportPiece>& pieces) const
+{
+	int childCount = 0;
+	int runStart = 0;
+	int runSize = 0;
+
+	exportOpen(nodePtr, path, format, first, pieces.back().text);
+	hydrate(nodePtr);
+	childCount = nodePtr->children.size();
+
+	// serializes children [begin, end) into *bufferPtr. Captures copies, as
+	// it may still run on the pool after this call has returned.
+	auto exportRun = [this, nodePtr, path, format](int begin, int end,
+		std::string* bufferPtr)
+	{
+		std::string childPath;
+
+		for (int i = begin; i < end; i++)
+		{
+			const std::shared_ptr<FSNode>& childPtr = nodePtr->children[i];
+
+			childPath = path + SEPARATING_CHAR + childPtr->name;
+			exportSerial(childPtr, childPath, format, i == 0, *bufferPtr);
+		}
+	};
+
+	// serializes children [runStart, end) into a chunk of their own if the
+	// run is large enough, otherwise into the current piece
+	auto flushRun = [&](int end)
+	{
+		int begin = runStart;
+
+		if (runSize >= EXPORT_CHUNK_NODES)
+		{
+			// deque keeps element addresses stable as pieces are added
+			pieces.emplace_back();
+			std::string* chunkPtr = &pieces.back().text;
+			pieces.back().done = FSThreadPool::shared().submit(
+				[exportRun, begin, end, chunkPtr]()
+			{
+				exportRun(begin, end, chunkPtr);
+			});
+			pieces.emplace_back(); // the caller continues in a new piece
+		}
+		else
+		{
+			exportRun(begin, end, &pieces.back().text);
+		}
+
+		runStart = end;
+		runSize = 0;
+	};
+
+	for (int i = 0; i < childCount; i++)
+	{
+		const std::shared_ptr<FSNode>& childPtr = nodePtr->children[i];
+		int childSize = countAtLeast(childPtr, EXPORT_CHUNK_NODES);
+
+		if (levels > 0 && childSize >= EXPORT_CHUNK_NODES)
+		{
+			// large directory, split it further on this thread
+			flushRun(i);
+			exportSplit(childPtr, path + SEPARATING_CHAR + childPtr->name,
+				format, i == 0, levels - 1, pieces);
+			runStart = i + 1;
+		}
+		else
+		{
+			runSize += childSize;
+
+			if (runSize >= EXPORT_CHUNK_NODES)
+			{
+				flushRun(i + 1);
+			}
+		}
+	}
+	flushRun(childCount);
+
+	exportClose(nodePtr, format, pieces.back().text);
+}
+
+void FilesystemTree::exportOpen(const std::shared_ptr<FSNode>& nodePtr,
+	const std::string& path, int format, bool first, std::string& buffer) const
+{
+	const char* type = nodePtr->isDirectory() ? "directory" : "file";
+
+	if (format == EXPORT_JSON)
+	{
+		buffer += first ? "{\"name\":" : ",{\"name\":";
+		appendJson(buffer, nodePtr->name);
+		buffer += ",\"type\":\"";
+		buffer += type;
+		buffer += nodePtr->isDirectory() ? "\",\"children\":[" : "\"";
+	}
+	else if (format == EXPORT_NDJSON)
+	{
+		buffer += "{\"path\":";
+		appendJson(buffer, path);
+		buffer += ",\"name\":";
+		appendJson(buffer, nodePtr->name);
+		buffer += ",\"type\":\"";
+		buffer += type;
+		buffer += "\"}\n";
+	}
+	else
+	{
+		appendCsv(buffer, path);
+		buffer += ',';
+		appendCsv(buffer, nodePtr->name);
+		buffer += ',';
+		buffer += type;
+		buffer += '\n';
+	}
+}
+
+void FilesystemTree::exportClose(const std::shared_ptr<FSNode>& nodePtr,
+	int format, std::string& buffer) const
+{
+	if (format == EXPORT_JSON)
+	{
+		buffer += nodePtr->isDirectory() ? "]}" : "}";
+	}
+}
+
+int FilesystemTree::watch(const std::string& path, bool recursive,
+	std::function<void(const FSEvent&)> callback)
+{
+	Watcher watcher;
+	watcher.recursive = recursive;
+	watcher.callback = callback;
+
+	return callback ? addWatcher(path, watcher) : -1;
+}
+
+int FilesystemTree::watch(const std::string& path, bool recursive,
+	std::shared_ptr<FSEventQueue> queue)
+{
+	Watcher watcher;
+	watcher.recursive = recursive;
+	watcher.queue = queue;
+
+	return queue != nullptr ? addWatcher(path, watcher) : -1;
+}
+
+int FilesystemTree::addWatcher(const std::string& path, Watcher watcher)
+{
+	std::shared_ptr<FSNode> nodePtr = pathToPointer(path);
+
+	if (nodePtr == nullptr || !nodePtr->isDirectory())
+	{
+		return -1;
+	}
+
+	watcher.id = nextWatchId++;
+	watchers[watchKey(path)].push_back(watcher);
+
+	return watcher.id;
+}
+
+bool FilesystemTree::unwatch(int watchId)
+{
+	for (auto entry = watchers.begin(); entry != watchers.end(); ++entry)
+	{
+		for (unsigned int i = 0; i < entry->second.size(); i++)
+		{
+			if (entry->second[i].id == watchId)
+			{
+				entry->second.erase(entry->second.begin() + i);
+				if (entry->second.empty())
+				{
+					watchers.erase(entry);
+				}
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+std::string FilesystemTree::watchKey(const std::string& path) const
+{
+	std::vector<std::string> names;
+	std::string key = ROOT_NAME;
+
+	// Build the key from the names pathToPointer() would look up, so every
+	// form of a path that reaches a directory gives that directory's key
+	if (!splitPath(path, names))
+	{
+		return path;
+	}
+
+	for (const std::string& name : names)
+	{
+		key += SEPARATING_CHAR + FSNode::cleanName(name);
+	}
+
+	return key;
+}
+
+void FilesystemTree::collectWatchers(const std::string& path,
+	std::vector<const Watcher*>& matched, const std::string& skipPath) const
+{
+	std::string key = path;
+	bool exact = true;
+
+	// Walk from the directory itself up through each ancestor
+	while (!key.empty())
+	{
+		auto entry = watchers.find(key);
+
+		if (entry != watchers.end())
+		{
+			// A walk from skipPath has already taken every watcher on
+			// skipPath and the recursive ones on its ancestors
+			bool onSkip = !skipPath.empty() && key == skipPath;
+			bool aboveSkip = !skipPath.empty() && !onSkip
+				&& skipPath.compare(0, key.length(), key) == 0
+				&& skipPath[key.length()] == SEPARATING_CHAR;
+
+			for (const Watcher& watcher : entry->second)
+			{
+				if ((exact || watcher.recursive) && !onSkip
+					&& !(aboveSkip && watcher.recursive))
+				{
+					matched.push_back(&watcher);
+				}
+			}
+		}
+
+		std::size_t slashIdx = key.rfind(SEPARATING_CHAR);
+		key.resize(slashIdx == std::string::npos ? 0 : slashIdx);
+		exact = false;
+	}
+}
+
+void FilesystemTree::publish(int kind, const std::string& name,
+	const std::string& path, const std::string& destPath) const
+{
+	if (watchers.empty())
+	{
+		return; // nobody is watching, cost nothing
+	}
+
+	std::vector<const Watcher*> matched;
+	FSEvent event;
+
+	event.kind = kind;
+	event.name = name;
+	event.path = watchKey(path);
+	event.destPath = destPath.empty() ? "" : watchKey(destPath);
+
+	if (kind != EVENT_COPY)
+	{
+		collectWatchers(event.path, matched); // a copy leaves its source alone
+	}
+	if (!event.destPath.empty())
+	{
+		collectWatchers(event.destPath, matched,
+			kind != EVENT_COPY ? event.path : "");
+	}
+
+	for (const Watcher* watcher : matched)
+	{
+		deliver(*watcher, event);
+	}
+}
+
+void FilesystemTree::deliver(const Watcher& watcher, const FSEvent& event)
+{
+	if (watcher.callback)
+	{
+		watcher.callback(event);
+	}
+	else
+	{
+		watcher.queue->push(event); // drops and flags the event when full
+	}
+}
+
+void FilesystemTree::updateFilters(const std::string& path,
+	const std::shared_ptr<FSNode>& addedPtr)
+{
+	FSBloomFilter added;
+	bool addedKnown = true;
+
+	if (addedPtr != nullptr)
+	{
+		added.add(FSBloomFilter::hashName(addedPtr->name));
+
+		if (addedPtr->isDirectory())
+		{
+			addedKnown = (addedPtr->subtreeFilter != nullptr);
+			if (addedKnown)
+			{
+				added.merge(*addedPtr->subtreeFilter);
+			}
+		}
+	}
+
+	std::vector<std::shared_ptr<FSNode>> chain;
+
+	pathToPointer(path, &chain);
+	for (const std::shared_ptr<FSNode>& nodePtr : chain)
+	{
+		if (addedPtr == nullptr)
+		{
+			nodePtr->filterStale = true; // still correct, just less selective
+		}
+		else if (!addedKnown)
+		{
+			nodePtr->subtreeFilter.reset(); // now holds an unknown subtree
+		}
+		else if (nodePtr->subtreeFilter != nullptr)
+		{
+			nodePtr->subtreeFilter->merge(added);
+		}
+	}
+
+	// Rebuilding costs a walk over the stale part of the tree, so it is
+	// batched over many removals
+	if (addedPtr == nullptr && ++removalsSinceRefresh >= FILTER_REFRESH_REMOVALS)
+	{
+		removalsSinceRefresh = 0;
+		if (rootPtr->subtreeFilter != nullptr && rootPtr->filterStale
+			&& rootPtr->subtreeFilter->fillRatio() > FILTER_REBUILD_FILL)
+		{
+			rebuildFilter(rootPtr);
+		}
+	}
+}
+
+void FilesystemTree::refreshFilters()
+{
+	removalsSinceRefresh = 0;
+	rebuildFilter(rootPtr);
+}
+
+bool FilesystemTree::mightContainBelow(const std::shared_ptr<FSNode>& nodePtr,
+	std::uint64_t nameHash) const
+{
+	bool rValue = true;
+
+	if (nodePtr->subtreeFilter != nullptr)
+	{
+		filterChecks.fetch_add(1, std::memory_order_relaxed);
+		rValue = nodePtr->subtreeFilter->mightContain(nameHash);
+		if (!rValue)
+		{
+			filterSkips.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	return rValue;
+}
+
+bool FilesystemTree::rebuildFilter(const std::shared_ptr<FSNode>& nodePtr)
+{
+	bool known = (nodePtr->imageOffset == 0);
+	FSBloomFilter filter;
+
+	// Every child is visited even once the result is unknown, so loaded
+	// subtrees get their filters next to unvisited ones
+	for (unsigned int i = 0; i < nodePtr->children.size(); i++)
+	{
+		const std::shared_ptr<FSNode>& childPtr = nodePtr->children[i];
+
+		filter.add(FSBloomFilter::hashName(childPtr->name));
+
+		if (childPtr->isDirectory())
+		{
+			// Fresh filters below are reused as they are
+			if (childPtr->filterStale || childPtr->subtreeFilter == nullptr)
+			{
+				rebuildFilter(childPtr);
+			}
+
+			if (childPtr->subtreeFilter == nullptr)
+			{
+				known = false;
+			}
+			else
+			{
+				filter.merge(*childPtr->subtreeFilter);
+			}
+		}
+	}
+
+	if (known)
+	{
+		nodePtr->subtreeFilter.reset(new FSBloomFilter(filter));
+		nodePtr->filterStale = false;
+	}
+	else
+	{
+		nodePtr->subtreeFilter.reset();
+	}
+
+	return known;
+}
+
+void FilesystemTree::displayFilterStats(std::ostream& outStream) const
+{
+	int filters = 0;
+	int staleFilters = 0;
+	double falsePositiveSum = 0.0;
+
+	recursiveFilterStats(rootPtr, filters, staleFilters, falsePositiveSum);
+
+	outStream << "Subtree filters: " << filters << " ("
+		<< filters * (sizeof(FSBloomFilter) + sizeof(std::unique_ptr<FSBloomFilter>))
+		<< " bytes)" << std::endl;
+	outStream << "Stale filters: " << staleFilters << std::endl;
+	outStream << "Estimated false positive rate: "
+		<< (filters > 0 ? 100.0 * falsePositiveSum / filters : 0.0) << "%"
+		<< std::endl;
+	outStream << "Subtrees skipped by find: " << filterSkips.load() << " of "
+		<< filterChecks.load() << " checked" << std::endl;
+}
+
+void FilesystemTree::recursiveFilterStats(std::shared_ptr<FSNode> nodePtr,
+	int& filters, int& staleFilters, double& falsePositiveSum) const
+{
+	if (nodePtr->subtreeFilter != nullptr)
+	{
+		filters++;
+		staleFilters += nodePtr->filterStale;
+		falsePositiveSum += nodePtr->subtreeFilter->falsePositiveRate();
+	}
+
+	// Unvisited snapshot directories have no children in memory yet
+	for (unsigned int i = 0; i < nodePtr->children.size(); i++)
+	{
+		if (nodePtr->children[i]->isDirectory())
+		{
+			recursiveFilterStats(nodePtr->children[i], filters, staleFilters,
+				falsePositiveSum);
+		}
+	}
+}
+
+bool FilesystemTree::adopt(const std::shared_ptr<FSNode>& nodePtr,
+	const std::string& parentPath)
+{
+	bool rValue = false;
+	std::shared_ptr<FSNode> parentPtr = pathToPointer(parentPath);
+
+	if (parentPtr != nullptr && parentPtr->addChild(nodePtr))
+	{
+		rValue = true;
+		parentPtr->dirty = true;
+		updateFilters(parentPath, nodePtr);
+		publish(EVENT_CREATE, nodePtr->getName(), parentPath, "");
+	}
+
+	return rValue;
+}
+
+std::size_t FSMemoryUsage::total() const
+{
+	return nodeHeaders + names + childArrays + indexes + caches + arenaSlack;
+}
+
+FSMemoryUsage FilesystemTree::memoryUsage(const std::string& path) const
+{
+	FSMemoryUsage usage;
+	std::shared_ptr<FSNode> nodePtr = pathToPointer(path);
+
+	if (nodePtr != nullptr)
+	{
+		recursiveMemoryUsage(nodePtr, usage);
+	}
+
+	if (nodePtr == rootPtr)
+	{
+		// Each registry entry is a hash node holding the key, its watcher
+		// vector and the cached hash
+		usage.caches += watchers.bucket_count() * sizeof(void*);
+		for (const auto& entry : watchers)
+		{
+			usage.caches += sizeof(void*) + sizeof(entry) + sizeof(std::size_t)
+				+ nameHeapBytes(entry.first)
+				+ entry.second.capacity() * sizeof(Watcher);
+		}
+
+		for (FSArena* arena : arenas)
+		{
+			usage.arenaSlack += arena->getBlockBytes() - arena->getBytesUsed();
+		}
+
+		if (imagePtr != nullptr)
+		{
+			usage.mapped = imagePtr->getSize();
+		}
 	}
-	
-	return rValue;
+
+	return usage;
 }
 
-bool FilesystemTree::remove(const std::string& pName, const std::string& parentPath)
+void FilesystemTree::recursiveMemoryUsage(const std::shared_ptr<FSNode>& nodePtr,
+	FSMemoryUsage& usage) const
 {
-	bool rValue = false;
+	usage.nodes++;
+	usage.nodeHeaders += nodePtr->inArena ? arenaNodeHeaderBytes() : nodeHeaderBytes();
+	usage.names += nameHeapBytes(nodePtr->name);
+	std::size_t heapSlots = childHeapSlots(nodePtr->children);
 
-	//make a node at the path parentPath.
-	std::shared_ptr<FSNode> parentPtr = pathToPointer(parentPath);
+	usage.childArrays += heapSlots * sizeof(std::shared_ptr<FSNode>);
+	if (heapSlots > 0)
+	{
+		usage.childSlack += (heapSlots - nodePtr->children.size())
+			* sizeof(std::shared_ptr<FSNode>);
+	}
 
-	//remove the node named pName from the directory at the path parentPath. 
-	if (pName != ROOT_NAME && parentPtr != nullptr && parentPtr->removeChild(pName))
+	if (nodePtr->subtreeFilter != nullptr)
 	{
-		//Returns true if the node was successfully removed.
-		rValue = true;
+		usage.indexes += sizeof(FSBloomFilter);
 	}
 
-	return rValue;
+	for (const std::shared_ptr<FSNode>& childPtr : nodePtr->children)
+	{
+		recursiveMemoryUsage(childPtr, usage);
+	}
 }
 
-
-bool FilesystemTree::move(const std::string& pName, const std::string& sourcePath,
-	const std::string& destPath)
+std::size_t FilesystemTree::shrink(const std::string& path)
 {
-	bool rValue = false;
-	
-	//make a node at the path sourcePath.
-	std::shared_ptr<FSNode> sourceParentPtr = pathToPointer(sourcePath);
-	//make a node at the path destPath.
-	std::shared_ptr<FSNode> destParentPtr = pathToPointer(destPath);
+	std::size_t freed = 0;
+	std::shared_ptr<FSNode> nodePtr = pathToPointer(path);
 
-	//should not allow the root node to be moved.
-	//if pName is a name of a directory, it moves the directory.
-	if (pName != ROOT_NAME 
-		&& sourceParentPtr != nullptr 
-		&& destParentPtr != nullptr 
-		&& nullptr != sourceParentPtr->getChild(pName))
+	if (nodePtr != nullptr)
 	{
-		//move the node named pName from the directory at the path sourcePath, 
-		std::shared_ptr<FSNode> moveNode = sourceParentPtr->getChild(pName);
+		FSMemoryUsage before;
+		FSMemoryUsage after;
 
-		//to the directory at destPath.
-		if (destParentPtr->addChild(moveNode))
-		{
-			//remove the child from the directory at the path sourcePath.
-			sourceParentPtr->removeChild(pName);
+		recursiveMemoryUsage(nodePtr, before);
+		recursiveShrink(nodePtr);
+		recursiveMemoryUsage(nodePtr, after);
 
-			//Returns true if the move was successful.
-			rValue = true;
-		}
+		freed = before.total() - after.total();
 	}
 
-	return rValue;
+	return freed;
 }
 
-std::shared_ptr<FSNode> FilesystemTree::copySubTree(std::shared_ptr<FSNode> rootPtr) const
+void FilesystemTree::recursiveShrink(const std::shared_ptr<FSNode>& nodePtr)
 {
-	std::shared_ptr<FSNode> rPtr = nullptr;
+	nodePtr->name.shrink_to_fit();
+	nodePtr->children.shrink_to_fit();
 
-	if (rootPtr != nullptr)
+	for (const std::shared_ptr<FSNode>& childPtr : nodePtr->children)
 	{
-		//copy node
-		rPtr = std::make_shared<FSNode>(rootPtr->name, rootPtr->type);
-
-		//copy tree nodes during a traversal
-		for (int i = 0; i < rootPtr->getNumChildren(); i++) 
-		{
-			//recursive copy
-			rPtr->addChild(copySubTree(rootPtr->getChild(i)));
-		}
+		recursiveShrink(childPtr);
 	}
+}
 
-	//Returns a fully independent copy of the subtree which begins at rootPtr. 
-	return rPtr;
-
+void FilesystemTree::compact()
+{
+	endCompaction();
+	compactStep(SIZE_MAX);
 }
 
-bool FilesystemTree::copy(const std::string& pName, const std::string& sourcePath,
-	const std::string& destPath)
+bool FilesystemTree::compactStep(std::size_t budget)
 {
-	bool rValue = false;
+	std::size_t moved = 0;
 
-	//make a node at the path sourcePath.
-	std::shared_ptr<FSNode> sourceParentPtr = pathToPointer(sourcePath);
-	//make a node at the path destPath.
-	std::shared_ptr<FSNode> destParentPtr = pathToPointer(destPath);
+	if (compactArena == nullptr && budget > 0)
+	{
+		releaseArenas(false);
+		compactArena = new FSArena();
+		arenas.push_back(compactArena);
+		rootPtr = relocate(rootPtr);
+		compactStack.push_back({ rootPtr, "", false });
+		moved++;
+	}
 
-	//should not allow the root node to be copied.
-	//if pName is a name of a directory it copies the directory.
-	if (pName != ROOT_NAME 
-		&& sourceParentPtr != nullptr 
-		&& destParentPtr != nullptr 
-		&& nullptr != sourceParentPtr->getChild(pName)) 
+	// Preorder: move a child, then everything below it, then its next sibling.
+	// Each directory resumes after the name of the last child it moved, so
+	// changes between slices cannot derail the walk.
+	while (!compactStack.empty() && moved < budget)
 	{
-		//copy the node named pName from the directory at the path sourcePath,
-		std::shared_ptr<FSNode> copyNode = copySubTree(sourceParentPtr->getChild(pName));
+		CompactFrame& frame = compactStack.back();
+		std::shared_ptr<FSNode> dirPtr = frame.dirPtr.lock();
+		int pos = 0;
 
-		//to the directory at destPath. 
-		if (destParentPtr->addChild(copyNode)) 
+		if (dirPtr == nullptr)
 		{
-			//Returns true if the copy was successful.
-			rValue = true;
+			compactStack.pop_back(); // removed since the last slice
+			continue;
+		}
+
+		if (frame.started)
+		{
+			pos = dirPtr->lowerBound(frame.lastName);
+			if (pos < dirPtr->getNumChildren() && dirPtr->children[pos]->name == frame.lastName)
+			{
+				pos++;
+			}
+		}
+
+		if (pos >= dirPtr->getNumChildren())
+		{
+			compactStack.pop_back();
+		}
+		else
+		{
+			std::shared_ptr<FSNode> childPtr = relocate(dirPtr->children[pos]);
+
+			dirPtr->children[pos] = childPtr;
+			frame.lastName = childPtr->name;
+			frame.started = true;
+			moved++;
+
+			if (childPtr->isDirectory())
+			{
+				compactStack.push_back({ childPtr, "", false });
+			}
 		}
 	}
 
-	return rValue;
+	bool done = compactStack.empty();
+	if (done)
+	{
+		endCompaction();
+	}
+
+	return done;
 }
 
+std::shared_ptr<FSNode> FilesystemTree::relocate(const std::shared_ptr<FSNode>& nodePtr)
+{
+	std::shared_ptr<FSNode> rPtr = std::allocate_shared<FSNode>(
+		FSArenaAllocator<FSNode>(compactArena), "", FILE_TYPE);
+
+	rPtr->name = nodePtr->name;
+	rPtr->type = nodePtr->type;
+	rPtr->children.assign(nodePtr->children.begin(), nodePtr->children.end());
+	rPtr->imageOffset = nodePtr->imageOffset;
+	rPtr->dirty = nodePtr->dirty;
+	rPtr->inArena = true;
+	if (nodePtr->subtreeFilter != nullptr)
+	{
+		rPtr->subtreeFilter.reset(new FSBloomFilter(*nodePtr->subtreeFilter));
+	}
+	rPtr->filterStale = nodePtr->filterStale;
 
+	return rPtr;
+}
 
+void FilesystemTree::endCompaction()
+{
+	compactStack.clear();
 
-/***********************************************************************/
-/************* YOU SHOULD NOT NEED TO EDIT BELOW THIS LINE *************/
-/***********************************************************************/
+	if (compactArena != nullptr)
+	{
+		compactArena->seal();
+		compactArena = nullptr; // still in arenas
+	}
+}
 
-int FilesystemTree::find(const std::string& pName, const std::string& startPath,
-	std::ostream& outStream) const
+void FilesystemTree::releaseArenas(bool all)
 {
-	int matches = 0;  // no results found
-	std::shared_ptr<FSNode> nodePtr = pathToPointer(startPath);
+	std::vector<FSArena*> kept;
 
-	if (nodePtr != nullptr)
+	for (FSArena* arena : arenas)
 	{
-		for (int i = 0; i < nodePtr->getNumChildren(); i++)
+		if (all || arena->isEmpty())
 		{
-			if (pName == nodePtr->getChild(i)->getName())
-			{
-				outStream << startPath + SEPARATING_CHAR + pName << std::endl;
-				matches++;
-			}
+			arena->release();
 		}
-
-		// recurse subdirectories
-		for (int i = 0; i < nodePtr->getNumChildren(); i++)
+		else
 		{
-			if (nodePtr->getChild(i)->isDirectory())
-			{
-				matches += find(pName,
-					startPath + SEPARATING_CHAR + nodePtr->getChild(i)->getName(),
-					outStream);
-			}
+			kept.push_back(arena);
 		}
 	}
 
-	return matches;
-
+	arenas.swap(kept);
 }
 
 bool FilesystemTree::format()
 {
+	std::chrono::steady_clock::time_point start = traceBegin();
 	bool rValue = true;
 
+	// Drop any unvisited snapshot contents along with everything else
+	rootPtr->imageOffset = 0;
+	rootPtr->dirty = true;
+
+	// The tree is about to be empty, so an empty filter is exact
+	rootPtr->subtreeFilter.reset(new FSBloomFilter());
+	rootPtr->filterStale = false;
+
 	// Set all children pointers to null. Should erase all subtrees
 	// since these are smart pointers.
 	while (rootPtr->getNumChildren() > 0)
@@ -186,14 +1404,35 @@ bool FilesystemTree::format()
 		rValue = (rValue && rootPtr->removeChild(rootPtr->getChild(0)->getName()));
 	}
 
+	// Everything was erased, so every watcher is told
+	if (!watchers.empty())
+	{
+		FSEvent event;
+		event.kind = EVENT_FORMAT;
+		event.path = ROOT_NAME;
+
+		for (const auto& entry : watchers)
+		{
+			for (const Watcher& watcher : entry.second)
+			{
+				deliver(watcher, event);
+			}
+		}
+	}
+
+	traceEnd(start, TRACE_FORMAT, rValue);
+
 	return rValue;
 }
 
 FilesystemTree& FilesystemTree::operator=(const FilesystemTree& rTree)
 {
+	endCompaction();
+
 	// What if there's an existing tree? Once rootPtr gets assigned a new value
 	// the old root node gets auto-removed because smart pointers.
 	rootPtr = copySubTree(rTree.rootPtr);
+	imagePtr = rTree.imagePtr; // shared by unvisited directories of the copy
 
 	return *this;
 }
@@ -219,6 +1458,8 @@ std::pair<int, int> FilesystemTree::recursiveStats(std::shared_ptr<FSNode> start
 		// recurse on children if this is a directory
 		if (startPtr->isDirectory())
 		{
+			hydrate(startPtr);
+
 			std::pair<int, int> rCount = { 0,0 };
 
 			for (int i = 0; i < startPtr->getNumChildren(); i++)
@@ -236,11 +1477,14 @@ std::pair<int, int> FilesystemTree::recursiveStats(std::shared_ptr<FSNode> start
 
 void FilesystemTree::displayStats(std::ostream& outStream) const
 {
+	std::chrono::steady_clock::time_point start = traceBegin();
 	std::pair<int, int> count = recursiveStats(rootPtr);
 
 	outStream << "Directories: " << count.first << std::endl;
 	outStream << "Files: " << count.second << std::endl;
 
+	traceEnd(start, TRACE_STATS, 0);
+
 }
 
 FilesystemTree::FilesystemTree()
@@ -273,6 +1517,12 @@ FilesystemTree::FilesystemTree(const std::string& fileName)
 			name = "";
 			path = "";
 
+			// Input files may have Windows line endings
+			if (command.length() > 0 && command[command.length() - 1] == '\r')
+			{
+				command.erase(command.length() - 1);
+			}
+
 			if (command[0] == '*') // create directory
 			{
 				command = command.substr(2, command.length() - 2);
@@ -300,22 +1550,21 @@ FilesystemTree::FilesystemTree(const std::string& fileName)
 	}
 }
 
-std::shared_ptr<FSNode> FilesystemTree::pathToPointer(const std::string& path) const
+bool FilesystemTree::splitPath(const std::string& path, std::vector<std::string>& names)
 {
 	std::string pathCpy = path;
-
-	int startIdx = 0;
 	int slashIdx = 0;
-	std::shared_ptr<FSNode> parentPtr = rootPtr;
+
+	names.clear();
 
 	if (pathCpy == ROOT_NAME)
 	{
-		return rootPtr;
+		return true;
 	}
 
 	if (pathCpy == "" || (pathCpy.substr(0, ROOT_NAME.length()) != ROOT_NAME))
 	{
-		return nullptr; // path doesn't start with ROOT_NAME
+		return false; // path doesn't start with ROOT_NAME
 	}
 
 	// Add a last / if there isn't one
@@ -324,22 +1573,67 @@ std::shared_ptr<FSNode> FilesystemTree::pathToPointer(const std::string& path) c
 		pathCpy += SEPARATING_CHAR;
 	}
 
+	// Anything between ROOT_NAME and the first / is ignored
 	slashIdx = pathCpy.find(SEPARATING_CHAR);
 	pathCpy = pathCpy.substr(slashIdx + 1, pathCpy.length() - slashIdx + 1);
 
-	while (parentPtr != nullptr && pathCpy.length() > 1)
+	while (pathCpy.length() > 1)
 	{
 		slashIdx = pathCpy.find(SEPARATING_CHAR);
-		parentPtr = parentPtr->getChild(pathCpy.substr(0, slashIdx));
+		names.push_back(pathCpy.substr(0, slashIdx));
 		pathCpy = pathCpy.substr(slashIdx + 1, pathCpy.length() - slashIdx + 1);
 	}
 
+	return true;
+}
+
+std::shared_ptr<FSNode> FilesystemTree::pathToPointer(const std::string& path,
+	std::vector<std::shared_ptr<FSNode>>* chain) const
+{
+	std::vector<std::string> names;
+	std::shared_ptr<FSNode> parentPtr = rootPtr;
+
+	if (chain != nullptr)
+	{
+		chain->clear();
+	}
+
+	if (!splitPath(path, names))
+	{
+		return nullptr;
+	}
+
+	for (unsigned int i = 0; parentPtr != nullptr && i < names.size(); i++)
+	{
+		if (chain != nullptr)
+		{
+			chain->push_back(parentPtr);
+		}
+		hydrate(parentPtr);
+		parentPtr = parentPtr->getChild(names[i]);
+	}
+
+	if (chain != nullptr)
+	{
+		if (parentPtr != nullptr)
+		{
+			chain->push_back(parentPtr);
+		}
+		else
+		{
+			chain->clear();
+		}
+	}
+
+	hydrate(parentPtr); // callers use the children of the result
 	return parentPtr;
 }
 
 void FilesystemTree::displayTree(std::ostream& outStream) const
 {
+	std::chrono::steady_clock::time_point start = traceBegin();
 	recursiveDisplay(rootPtr, "", outStream);
+	traceEnd(start, TRACE_DISPLAY, 0);
 }
 
 void FilesystemTree::recursiveDisplay(std::shared_ptr<FSNode> nodePtr,
@@ -351,6 +1645,7 @@ void FilesystemTree::recursiveDisplay(std::shared_ptr<FSNode> nodePtr,
 
 	if (nodePtr->isDirectory())
 	{
+		hydrate(nodePtr);
 
 		for (int i = 0; i < nodePtr->getNumChildren(); i++)
 		{
@@ -359,7 +1654,229 @@ void FilesystemTree::recursiveDisplay(std::shared_ptr<FSNode> nodePtr,
 	}
 }
 
+void FilesystemTree::hydrate(const std::shared_ptr<FSNode>& nodePtr) const
+{
+	if (nodePtr != nullptr && nodePtr->imageOffset != 0 && imagePtr != nullptr)
+	{
+		std::vector<FSImage::Entry> entries 
+			= imagePtr->readDirectory(nodePtr->imageOffset);
+
+		FSBloomFilter filter;
+		bool known = true;
+
+		// Records are written in sorted order, so no sorted insert is needed
+		nodePtr->children.reserve(entries.size());
+		for (const FSImage::Entry& entry : entries)
+		{
+			std::shared_ptr<FSNode> childPtr 
+				= std::make_shared<FSNode>(entry.name, entry.type);
+
+			if (childPtr->isDirectory())
+			{
+				childPtr->imageOffset = entry.offset;
+				childPtr->subtreeFilter.reset(); // contents not known yet
+				known = false;
+			}
+			filter.add(FSBloomFilter::hashName(childPtr->name));
+			nodePtr->children.push_back(childPtr);
+		}
+
+		// A directory holding only files is fully known once loaded. Others
+		// get their filter from refreshFilters() once everything below is.
+		if (known)
+		{
+			nodePtr->subtreeFilter.reset(new FSBloomFilter(filter));
+		}
+		nodePtr->imageOffset = 0;
+	}
+}
+
+void FilesystemTree::openSnapshot(const std::string& fileName)
+{
+	std::shared_ptr<FSImage> newImagePtr = std::make_shared<FSImage>(fileName);
+
+	endCompaction();
+
+	rootPtr = std::make_shared<FSNode>("", 1);
+	rootPtr->name = ROOT_NAME; // get around alpha/digit name restriction
+	rootPtr->imageOffset = newImagePtr->getRootOffset();
+	rootPtr->subtreeFilter.reset(); // contents not known yet
+	imagePtr = newImagePtr;
+}
+
+bool FilesystemTree::saveSnapshot(const std::string& fileName) const
+{
+	std::string buffer;
+	std::string tempName = fileName + ".tmp";
+	std::ofstream outFile;
+
+	// A tree the format cannot hold is refused before anything is written
+	try
+	{
+		FSImage::beginImage(buffer);
+		FSImage::endImage(buffer, writeSnapshotRecord(rootPtr, buffer));
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+
+	// Write beside the target and rename, so a snapshot that is currently
+	// mapped is never truncated underneath the tree.
+	outFile.open(tempName.c_str(), std::ios::binary | std::ios::trunc);
+	outFile.write(buffer.data(), buffer.size());
+	outFile.close();
+
+	return !outFile.fail() && std::rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+std::uint64_t FilesystemTree::writeSnapshotRecord(std::shared_ptr<FSNode> nodePtr,
+	std::string& buffer) const
+{
+	if (nodePtr->imageOffset != 0)
+	{
+		return writeImageRecord(nodePtr->imageOffset, buffer);
+	}
+
+	std::vector<FSImage::Entry> entries(nodePtr->children.size());
+
+	for (unsigned int i = 0; i < nodePtr->children.size(); i++)
+	{
+		std::shared_ptr<FSNode> childPtr = nodePtr->children[i];
+
+		entries[i].name = childPtr->name;
+		entries[i].type = childPtr->type;
+		entries[i].offset = childPtr->isDirectory() 
+			? writeSnapshotRecord(childPtr, buffer) : 0;
+	}
+
+	return FSImage::appendDirectory(buffer, entries);
+}
+
+std::uint64_t FilesystemTree::writeImageRecord(std::uint64_t offset,
+	std::string& buffer) const
+{
+	// A record being copied and the next of its entries to look at
+	struct ImageFrame
+	{
+		std::vector<FSImage::Entry> entries;
+		std::size_t next;
+	};
+
+	std::vector<ImageFrame> stack;
+	std::uint64_t written = 0;
+
+	stack.push_back({ imagePtr->readDirectory(offset), 0 });
+
+	while (!stack.empty())
+	{
+		ImageFrame& frame = stack.back();
+
+		if (frame.next == frame.entries.size())
+		{
+			// Every subdirectory is written, so this record can be too
+			written = FSImage::appendDirectory(buffer, frame.entries);
+			stack.pop_back();
+			if (!stack.empty())
+			{
+				stack.back().entries[stack.back().next++].offset = written;
+			}
+		}
+		else if (frame.entries[frame.next].type == DIR_TYPE)
+		{
+			std::uint64_t childOffset = frame.entries[frame.next].offset;
+			stack.push_back({ imagePtr->readDirectory(childOffset), 0 });
+		}
+		else
+		{
+			frame.next++;
+		}
+	}
+
+	return written;
+}
+
+void FilesystemTree::displayHydrationStats(std::ostream& outStream) const
+{
+	HydrationCount count;
+
+	recursiveHydrationStats(rootPtr, count);
+
+	outStream << "Hydrated directories: " << count.hydrated << std::endl;
+	outStream << "Unhydrated directories: " << count.unhydrated << std::endl;
+	outStream << "Dirty directories: " << count.dirty << std::endl;
+}
+
+void FilesystemTree::recursiveHydrationStats(std::shared_ptr<FSNode> nodePtr,
+	HydrationCount& count) const
+{
+	if (nodePtr->imageOffset != 0)
+	{
+		count.unhydrated++; // its subtree has not been read at all
+	}
+	else if (nodePtr->isDirectory())
+	{
+		count.hydrated++;
+		count.dirty += nodePtr->dirty;
+
+		for (unsigned int i = 0; i < nodePtr->children.size(); i++)
+		{
+			recursiveHydrationStats(nodePtr->children[i], count);
+		}
+	}
+}
+
 FilesystemTree::~FilesystemTree()
 {
+	endCompaction();
 	rootPtr = nullptr; // Strictly speaking not necessary because smart pointers.
-}
\ No newline at end of file
+	releaseArenas(true);
+}
+
+void FilesystemTree::startTrace(const std::string& fileName)
+{
+	tracePtr.reset(new FSTraceWriter(fileName));
+}
+
+std::size_t FilesystemTree::stopTrace()
+{
+	std::size_t recordCount = 0;
+
+	if (tracePtr != nullptr)
+	{
+		recordCount = tracePtr->getRecordCount();
+		tracePtr.reset();
+	}
+
+	return recordCount;
+}
+
+std::chrono::steady_clock::time_point FilesystemTree::traceBegin() const
+{
+	return (tracePtr != nullptr)
+		? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+}
+
+void FilesystemTree::traceEnd(std::chrono::steady_clock::time_point start,
+	std::uint8_t op, std::uint32_t result, std::uint32_t number,
+	const std::string& name, const std::string& path,
+	const std::string& destPath) const
+{
+	if (tracePtr != nullptr)
+	{
+		std::int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+		FSTraceRecord record;
+
+		record.op = op;
+		record.elapsedNanos = static_cast<std::uint32_t>(
+			std::min<std::int64_t>(elapsed, UINT32_MAX));
+		record.result = result;
+		record.number = number;
+		record.name = name;
+		record.path = path;
+		record.destPath = destPath;
+
+		tracePtr->write(record);
+	}
+}
@@ -1,11 +1,22 @@
 #ifndef FILESYSTEMTREE
 #define FILESYSTEMTREE
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory> // for smart pointers
+#include <unordered_map>
 #include <utility> // for pair class
+#include <vector>
 #include <iostream>
 #include "FSNode.h"
+#include "FSArena.h"
+#include "FSImage.h"
+#include "FSTrace.h"
+#include "FSWatch.h"
 
 // The name of the root node is enforced to be unique, no other file/directory
 // may have this name.  It MAY contain non-alpha and non-digit characters,
@@ -14,7 +25,52 @@ const std::string ROOT_NAME = "C:";
 
 // Separating char defines what separates entities in a path. It MUST be 
 // non-alpha and non-digit or chaos will ensue.
-const char SEPARATING_CHAR = '/';
+constexpr char SEPARATING_CHAR = '/';
+
+static_assert(!FSNamePolicy::isAllowed(SEPARATING_CHAR),
+	"SEPARATING_CHAR must not be allowed in names");
+
+// Output formats for FilesystemTree::exportTree()
+constexpr int EXPORT_JSON = 0; // one nested JSON object
+constexpr int EXPORT_NDJSON = 1; // one JSON object per line with its full path
+constexpr int EXPORT_CSV = 2; // path,name,type header then one row per node
+
+/*
+* One page of a directory listing returned by FilesystemTree::list().
+*/
+struct FSListPage
+{
+	std::vector<std::string> names; // entry names in sorted order
+	std::vector<int> types; // DIR_TYPE or FILE_TYPE for each entry in names
+	std::string cursor; // pass as startAfter to get the next page
+	bool hasMore = false; // true if entries remain after this page
+};
+
+/*
+* Memory used by a FilesystemTree or one of its subtrees, as returned by
+* FilesystemTree::memoryUsage(). Byte counts are what was requested from the
+* allocator, without its own per-allocation overhead.
+*/
+struct FSMemoryUsage
+{
+	std::size_t nodes = 0; // nodes counted
+	std::size_t nodeHeaders = 0; // FSNode objects and their shared_ptr control blocks
+	std::size_t names = 0; // name characters kept outside the std::string itself
+	std::size_t childArrays = 0; // child array storage on the heap, slack included
+	std::size_t childSlack = 0; // the part of childArrays holding no child
+	std::size_t indexes = 0; // subtree Bloom filters
+	std::size_t caches = 0; // watch registry
+	std::size_t arenaSlack = 0; // compaction arena blocks holding no live node
+
+	// Size of the snapshot file mapping. The kernel pages it in on demand
+	// and can drop it again, so it is kept out of total().
+	std::size_t mapped = 0;
+
+	/*
+	* @return The sum of every heap byte category.
+	*/
+	std::size_t total() const;
+};
 
 class FilesystemTree
 {
@@ -118,10 +174,89 @@ public:
 	*                  written.
 	* @return The total number of matches found (the same as the
 	*         number of lines written to outStream).
+	*
+	* find() only reads subtree filters, never rebuilds them, so several
+	* find() calls may run at once on a tree that has no unvisited snapshot
+	* directories left (visiting one creates its children).
 	*/
 	int find(const std::string& pName, const std::string& startPath, 
 		std::ostream& outStream) const;
 
+	/*
+	* list() returns one page of the entries of a directory in sorted order,
+	* optionally only those whose names begin with prefix. Runs in 
+	* O(log n + limit) for a directory with n entries.
+	*
+	* The cursor of a page is the last name on it, so it stays valid when
+	* entries are created or removed in the directory between calls: the
+	* next page starts at the first name after it that exists at that time.
+	*
+	* @param path Path to the directory to list. Must begin with ROOT_NAME 
+	*             and be delimited by SEPARATING_CHAR.
+	* @param prefix Only list names that begin with prefix. "" lists all.
+	* @param startAfter Only list names greater than this, normally the cursor
+	*                   of the previous page. "" starts at the first entry.
+	* @param limit Maximum number of entries in the page.
+	* @return The page. Empty if path is not an existing directory.
+	*/
+	FSListPage list(const std::string& path, const std::string& prefix,
+		const std::string& startAfter, int limit) const;
+
+	/*
+	* exportTree() writes a directory (or file) and everything below it in a
+	* structured format. Large subtrees are serialized on the shared thread
+	* pool into separate chunk buffers, which are written to outStream in
+	* order as they complete.
+	*
+	* @param path Path to the node to export. Must begin with ROOT_NAME and
+	*             be delimited by SEPARATING_CHAR.
+	* @param format EXPORT_JSON, EXPORT_NDJSON or EXPORT_CSV.
+	* @param outStream The output stream to write to.
+	* @return True if successful, false if path does not exist or format is
+	*         unknown.
+	*/
+	bool exportTree(const std::string& path, int format,
+		std::ostream& outStream) const;
+
+	/*
+	* watch() subscribes to changes made in a directory by create(), remove(),
+	* move(), copy() and format(). The callback runs synchronously on the
+	* thread making the change, after the change is complete.
+	*
+	* Matching a change against the watches costs O(depth of the changed
+	* directory), however many watches exist. A watch is keyed by path: it
+	* does not follow its directory if that is moved, and it is not told
+	* when its own directory is removed unless it watches an ancestor.
+	* watch() and unwatch() must not race with changes to the tree, and
+	* callbacks must not call them.
+	*
+	* @param path Path to an existing directory. Must begin with ROOT_NAME and
+	*             be delimited by SEPARATING_CHAR.
+	* @param recursive If true, changes anywhere below path are reported too.
+	* @param callback Called with each matching event.
+	* @return An id for unwatch(), or -1 if path is not a directory.
+	*/
+	int watch(const std::string& path, bool recursive,
+		std::function<void(const FSEvent&)> callback);
+
+	/*
+	* watch() overload which publishes matching events to a lock-free queue
+	* instead, so that another thread can consume them without ever blocking
+	* the thread changing the tree. See FSEventQueue for overflow handling.
+	*
+	* @param queue The queue to push events to. One queue per watch.
+	*/
+	int watch(const std::string& path, bool recursive,
+		std::shared_ptr<FSEventQueue> queue);
+
+	/*
+	* unwatch() cancels a watch.
+	*
+	* @param watchId The id returned by watch().
+	* @return True if the watch existed.
+	*/
+	bool unwatch(int watchId);
+
 	/*
 	* displayStats() displays the total file and directory counts. DOES NOT
 	* count ROOT_NAME as a directory.
@@ -137,6 +272,123 @@ public:
 	*/
 	bool format();
 
+	/*
+	* openSnapshot() replaces the tree with the one stored in a snapshot file
+	* written by saveSnapshot(). The file is memory-mapped and directories
+	* are only created when first visited, so opening is near-instant and
+	* memory grows with the part of the tree actually used. Throws
+	* std::runtime_error if the file is missing or not a snapshot.
+	*
+	* @param fileName Name of the snapshot file.
+	*/
+	void openSnapshot(const std::string& fileName);
+
+	/*
+	* saveSnapshot() writes the tree to a snapshot file. Directories that were
+	* never visited are copied from the current snapshot without being created.
+	*
+	* @param fileName Name of the snapshot file. May be the file currently open.
+	* @return True if successful, false if the file could not be written or
+	*         a name is longer than FSImage::MAX_NAME_LENGTH.
+	*/
+	bool saveSnapshot(const std::string& fileName) const;
+
+	/*
+	* displayHydrationStats() displays how many directories have been created
+	* from the snapshot, how many are still unvisited and how many have been
+	* changed since they were loaded. Does not load any directories.
+	*
+	* @param outStream The output stream where the counts will be written.
+	*/
+	void displayHydrationStats(std::ostream& outStream) const;
+
+	/*
+	* displayFilterStats() displays the memory used by the per-directory
+	* subtree filters that let find() skip subtrees, their estimated false
+	* positive rate and how many subtrees find() has skipped so far.
+	*
+	* @param outStream The output stream where the stats will be written.
+	*/
+	void displayFilterStats(std::ostream& outStream) const;
+
+	/*
+	* refreshFilters() rebuilds the subtree filters that removals have left
+	* stale, and builds the missing filters of directories whose subtree has
+	* been fully loaded from the snapshot. Stale filters are also refreshed
+	* automatically every FILTER_REFRESH_REMOVALS removals while the root
+	* has a filter; missing ones only by this call.
+	*/
+	void refreshFilters();
+
+	/*
+	* memoryUsage() adds up the memory used by a directory (or file) and
+	* everything below it. Directories below path not yet loaded from a
+	* snapshot count as empty and are not loaded.
+	*
+	* @param path Path to the node. Must begin with ROOT_NAME and be
+	*             delimited by SEPARATING_CHAR. The tree's caches, arena
+	*             slack and snapshot mapping are only counted for the root,
+	*             and the watch registry estimate leaves out what callbacks
+	*             capture.
+	* @return The usage by category, all zero if path does not exist.
+	*/
+	FSMemoryUsage memoryUsage(const std::string& path = ROOT_NAME) const;
+
+	/*
+	* shrink() frees the unused capacity of the child arrays and names of a
+	* directory (or file) and everything below it. Later inserts grow the
+	* arrays again as needed.
+	*
+	* @param path Path to the node. Must begin with ROOT_NAME and be
+	*             delimited by SEPARATING_CHAR.
+	* @return The number of bytes freed.
+	*/
+	std::size_t shrink(const std::string& path = ROOT_NAME);
+
+	/*
+	* compact() rebuilds every node into fresh contiguous storage in
+	* depth-first preorder, so each subtree sits in one dense block and full
+	* traversals touch memory in order. Only the nodes themselves go into
+	* that storage: long names, child arrays and filters are copied to
+	* ordinary heap allocations, made in the same order. Directories not yet
+	* loaded from a snapshot are moved as they are, without being loaded.
+	* Storage is returned block by block as the nodes in it are removed.
+	*
+	* Abandons any compaction started by compactStep() and does a whole
+	* pass at once.
+	*/
+	void compact();
+
+	/*
+	* compactStep() does a bounded slice of the work of compact(), starting
+	* a new pass if none is under way. The tree may be changed freely
+	* between slices. Nodes created during the pass behind its position are
+	* left where they are until the next pass.
+	*
+	* @param budget Maximum number of nodes to move in this slice.
+	* @return True if this slice finished the pass.
+	*/
+	bool compactStep(std::size_t budget);
+
+	/*
+	* startTrace() records every later call to create(), remove(), move(),
+	* copy(), find(), list(), exportTree(), displayTree(), displayStats() and
+	* format() with its arguments, result and duration, until stopTrace().
+	* The trace can be re-run with the replay tool against a tree loaded
+	* from the same starting state. Throws std::runtime_error if the file
+	* cannot be created.
+	*
+	* @param fileName Name of the trace file. Replaced if it exists.
+	*/
+	void startTrace(const std::string& fileName);
+
+	/*
+	* stopTrace() ends the current trace, if any, and closes its file.
+	*
+	* @return Number of calls recorded in the trace.
+	*/
+	std::size_t stopTrace();
+
 	/*
 	* Overloaded assignment operator which does a deep copy.
 	*
@@ -171,6 +423,18 @@ private:
 	*/
 	std::pair<int, int> recursiveStats(std::shared_ptr<FSNode> startPtr) const;
 
+	/*
+	* recursiveFind() is a recursive helper function for the public find().
+	* Writes a line for each match below nodePtr, skipping subdirectories
+	* whose subtree filter rules the name out.
+	*
+	* @param path Path of nodePtr. Extended and restored while recursing.
+	* @return The number of matches found.
+	*/
+	int recursiveFind(const std::shared_ptr<FSNode>& nodePtr,
+		const std::string& pName, std::uint64_t nameHash, std::string& path,
+		std::ostream& outStream) const;
+
 	/*
 	* Helper function to make an independent copy of a subtree recursively
 	* beginning at a given node. If called on the root then it copies
@@ -181,6 +445,86 @@ private:
 	*/
 	std::shared_ptr<FSNode> copySubTree(std::shared_ptr<FSNode> rootPtr) const;
 
+	/*
+	* cloneNode() copies a single node without its children.
+	*/
+	std::shared_ptr<FSNode> cloneNode(const std::shared_ptr<FSNode>& nodePtr) const;
+
+	/*
+	* copySerial() copies a subtree on the calling thread. The source children
+	* are already sorted and unique, so they are appended in order without
+	* going through addChild().
+	*
+	* @param nodePtr Pointer to the root node of the subtree to copy.
+	* @return A pointer to an independent copy of the subtree.
+	*/
+	std::shared_ptr<FSNode> copySerial(const std::shared_ptr<FSNode>& nodePtr) const;
+
+	/*
+	* copySplit() copies the top levels of a large subtree on the calling
+	* thread and hands runs of children worth at least 
+	* PARALLEL_COPY_THRESHOLD nodes to the shared thread pool. The copy is
+	* only complete once every future added to tasks is ready.
+	*
+	* @param nodePtr Pointer to the root node of the subtree to copy.
+	* @param levels How many more levels may be split on this thread.
+	* @param tasks Receives the futures of the submitted tasks.
+	* @return A pointer to the copy of nodePtr.
+	*/
+	std::shared_ptr<FSNode> copySplit(const std::shared_ptr<FSNode>& nodePtr,
+		int levels, std::vector<std::future<void>>& tasks) const;
+
+	// A run of the export output. Chunks serialized on the pool carry the
+	// future that completes them, text written by the caller does not.
+	struct ExportPiece
+	{
+		std::string text;
+		std::future<void> done;
+	};
+
+	/*
+	* exportSerial() appends a node and its whole subtree to buffer on the
+	* calling thread.
+	*
+	* @param nodePtr The node to export.
+	* @param path Full path to nodePtr. Child names are appended to it while
+	*             the children are written and removed again afterwards.
+	* @param format One of the EXPORT_ constants.
+	* @param first false if a sibling was written before this node.
+	* @param buffer Receives the output.
+	*/
+	void exportSerial(const std::shared_ptr<FSNode>& nodePtr,
+		std::string& path, int format, bool first,
+		std::string& buffer) const;
+
+	/*
+	* exportSplit() is the parallel counterpart of exportSerial(). It writes
+	* the top levels of the subtree on the calling thread and queues runs of
+	* children worth at least EXPORT_CHUNK_NODES nodes as chunks on the
+	* thread pool. New text always goes to pieces.back().
+	*/
+	void exportSplit(const std::shared_ptr<FSNode>& nodePtr,
+		const std::string& path, int format, bool first, int levels,
+		std::deque<ExportPiece>& pieces) const;
+
+	/*
+	* exportOpen() and exportClose() append what a format writes before and
+	* after the children of a node.
+	*/
+	void exportOpen(const std::shared_ptr<FSNode>& nodePtr,
+		const std::string& path, int format, bool first,
+		std::string& buffer) const;
+	void exportClose(const std::shared_ptr<FSNode>& nodePtr, int format,
+		std::string& buffer) const;
+
+	/*
+	* countAtLeast() counts the nodes of a subtree, stopping early once limit
+	* is reached, so that size checks stay cheap for huge subtrees.
+	*
+	* @return The subtree size, or limit if it has limit nodes or more.
+	*/
+	int countAtLeast(const std::shared_ptr<FSNode>& nodePtr, int limit) const;
+
 	/*
 	* Helper funciton to convert a full path to a file/directory to a pointer
 	* to that file directory.  For example, given root/dir1/file3 it returns
@@ -188,10 +532,231 @@ private:
 	*
 	* @param path Full path to a file or directory. Must begin with ROOT_NAME
 	*             and be delimited by SEPARATING_CHAR.
+	* @param chain If not nullptr, receives every node on the way: root
+	*              first, the node at path last. Empty if path does not
+	*              exist.
+	*/
+	std::shared_ptr<FSNode> pathToPointer(const std::string& path,
+		std::vector<std::shared_ptr<FSNode>>* chain = nullptr) const;
+
+	/*
+	* splitPath() breaks a path into the names pathToPointer() looks up, in
+	* order. Both share it, so every path form one accepts the other
+	* understands the same way.
+	*
+	* @param names Receives the names below ROOT_NAME, empty for the root.
+	* @return false if path does not begin with ROOT_NAME.
+	*/
+	static bool splitPath(const std::string& path, std::vector<std::string>& names);
+
+	/*
+	* hydrate() creates the children of a directory loaded from a snapshot if
+	* that has not happened yet. Does nothing for any other node.
+	*
+	* @param nodePtr The directory whose children are about to be used.
 	*/
-	std::shared_ptr<FSNode> pathToPointer(const std::string& path) const;
+	void hydrate(const std::shared_ptr<FSNode>& nodePtr) const;
+
+	/*
+	* Helpers for saveSnapshot() that append the directory record of a node,
+	* or of an unvisited directory in the current snapshot, after the records
+	* of all its subdirectories. writeImageRecord() keeps its own stack, as
+	* the depth of a snapshot is only bounded by its file size.
+	*
+	* @return The offset of the record in buffer.
+	*/
+	std::uint64_t writeSnapshotRecord(std::shared_ptr<FSNode> nodePtr,
+		std::string& buffer) const;
+	std::uint64_t writeImageRecord(std::uint64_t offset,
+		std::string& buffer) const;
+
+	// Directory counts reported by displayHydrationStats()
+	struct HydrationCount
+	{
+		int hydrated = 0;
+		int unhydrated = 0;
+		int dirty = 0;
+	};
+
+	/*
+	* recursiveHydrationStats() is a recursive helper function for the public
+	* displayHydrationStats().
+	*/
+	void recursiveHydrationStats(std::shared_ptr<FSNode> nodePtr,
+		HydrationCount& count) const;
+
+	// A subscription created by watch(). Exactly one of callback and queue
+	// is set.
+	struct Watcher
+	{
+		int id;
+		bool recursive;
+		std::function<void(const FSEvent&)> callback;
+		std::shared_ptr<FSEventQueue> queue;
+	};
+
+	/*
+	* addWatcher() validates path and registers the watcher for both public
+	* watch() overloads.
+	*/
+	int addWatcher(const std::string& path, Watcher watcher);
+
+	/*
+	* watchKey() converts a path to the form watchers are keyed by: ROOT_NAME
+	* followed by the names splitPath() finds in it, each cleaned as
+	* FSNode::cleanName() does, so it matches the stored names.
+	*/
+	std::string watchKey(const std::string& path) const;
+
+	/*
+	* collectWatchers() appends the watchers interested in a change in the
+	* directory at path: those on path itself plus the recursive ones on
+	* each of its ancestors.
+	*
+	* @param skipPath The key of a directory already collected for the same
+	*                 event, "" if none. Watchers that matched for it are
+	*                 left out, so each is delivered the event once without
+	*                 searching matched.
+	*/
+	void collectWatchers(const std::string& path,
+		std::vector<const Watcher*>& matched, const std::string& skipPath = "") const;
+
+	/*
+	* publish() delivers an event to the watchers of the directory it
+	* happened in and, for moves and copies, of the destination. Does nothing
+	* if there are no watchers.
+	*/
+	void publish(int kind, const std::string& name, const std::string& path,
+		const std::string& destPath) const;
+
+	/*
+	* deliver() hands an event to one watcher.
+	*/
+	static void deliver(const Watcher& watcher, const FSEvent& event);
+
+	/*
+	* updateFilters() keeps the subtree filters of a directory and all of its
+	* ancestors in step with a change made in that directory.
+	*
+	* @param path Path to the directory that changed.
+	* @param addedPtr The node added to the directory, or nullptr if a node
+	*                 was removed.
+	*/
+	void updateFilters(const std::string& path,
+		const std::shared_ptr<FSNode>& addedPtr);
+
+	/*
+	* mightContainBelow() checks a directory's subtree filter for a name.
+	*
+	* @return false if no node below nodePtr can have the name.
+	*/
+	bool mightContainBelow(const std::shared_ptr<FSNode>& nodePtr,
+		std::uint64_t nameHash) const;
+
+	/*
+	* rebuildFilter() recomputes the subtree filter of a directory from its
+	* children, rebuilding stale and missing filters below it on the way.
+	*
+	* @return false if the subtree is not fully known, in which case the
+	*         filter is dropped.
+	*/
+	bool rebuildFilter(const std::shared_ptr<FSNode>& nodePtr);
+
+	/*
+	* recursiveFilterStats() is a recursive helper function for the public
+	* displayFilterStats(). Adds up filter count, stale count and estimated
+	* false positive rates.
+	*/
+	void recursiveFilterStats(std::shared_ptr<FSNode> nodePtr, int& filters,
+		int& staleFilters, double& falsePositiveSum) const;
+
+	/*
+	* adopt() adds a node taken from another tree to the directory at
+	* parentPath, the way copy() adds its copy. The node must be fully
+	* loaded, since it is not read from this tree's snapshot.
+	*
+	* @return True if the node was added, false if parentPath is not a
+	*         directory or already has an entry of that name.
+	*/
+	bool adopt(const std::shared_ptr<FSNode>& nodePtr, const std::string& parentPath);
+
+	/*
+	* Recursive helpers for the public memoryUsage() and shrink().
+	*/
+	void recursiveMemoryUsage(const std::shared_ptr<FSNode>& nodePtr,
+		FSMemoryUsage& usage) const;
+	void recursiveShrink(const std::shared_ptr<FSNode>& nodePtr);
+
+	// Progress of a compaction in one directory: the last child moved. The
+	// directory is not kept alive, so one removed meanwhile is skipped.
+	struct CompactFrame
+	{
+		std::weak_ptr<FSNode> dirPtr;
+		std::string lastName;
+		bool started;
+	};
+
+	/*
+	* relocate() makes a copy of a single node in compactArena. The copy
+	* takes over the node's children, which stay where they are.
+	*/
+	std::shared_ptr<FSNode> relocate(const std::shared_ptr<FSNode>& nodePtr);
+
+	/*
+	* endCompaction() abandons the compaction in progress, if any.
+	*/
+	void endCompaction();
+
+	/*
+	* releaseArenas() lets go of the arenas no node lives in any more, or of
+	* all of them. Nodes still in a released arena keep it alive.
+	*/
+	void releaseArenas(bool all);
+
+	/*
+	* traceBegin() and traceEnd() bracket a traced call. Both do nothing
+	* unless a trace is being recorded.
+	*
+	* @param start The value traceBegin() returned.
+	* @param op One of the TRACE_ constants. See FSTrace.h for the
+	*           arguments each op keeps.
+	*/
+	std::chrono::steady_clock::time_point traceBegin() const;
+	void traceEnd(std::chrono::steady_clock::time_point start, std::uint8_t op,
+		std::uint32_t result, std::uint32_t number = 0,
+		const std::string& name = "", const std::string& path = "",
+		const std::string& destPath = "") const;
 
 	std::shared_ptr<FSNode> rootPtr; // pointer to the root of the filesystem
+
+	// find() subtree filter checks, and how many of them skipped the subtree
+	mutable std::atomic<std::size_t> filterChecks{ 0 };
+	mutable std::atomic<std::size_t> filterSkips{ 0 };
+
+	// Removals since stale filters were last refreshed
+	int removalsSinceRefresh = 0;
+
+	// Watchers by the watchKey() of the directory they watch
+	std::unordered_map<std::string, std::vector<Watcher>> watchers;
+	int nextWatchId = 0;
+
+	// Snapshot the unhydrated directories are read from, nullptr if none
+	std::shared_ptr<FSImage> imagePtr;
+
+	// Trace being recorded, nullptr if none. Not copied with the tree.
+	std::unique_ptr<FSTraceWriter> tracePtr;
+
+	// Compaction in progress: directories still being walked, innermost
+	// last, and the arena nodes are moved into (nullptr if none)
+	std::vector<CompactFrame> compactStack;
+	FSArena* compactArena = nullptr;
+
+	// Arenas of every pass that may still hold nodes, each with the owner
+	// reference, so memoryUsage() can count their slack
+	std::vector<FSArena*> arenas;
+
+	// Hands whole subtrees between its shards with adopt() and copySubTree()
+	friend class ShardedFilesystemTree;
 	
 }; // end FilesystemTree
 
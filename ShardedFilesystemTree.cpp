@@ -0,0 +1,331 @@
+#include "ShardedFilesystemTree.h"
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+
+ShardedFilesystemTree::ShardedFilesystemTree(int shardCount)
+{
+	if (shardCount < 1)
+	{
+		throw std::runtime_error("A sharded tree needs at least one shard.");
+	}
+
+	for (int i = 0; i < shardCount; i++)
+	{
+		shards.emplace_back(new Shard());
+		if (FS_USE_THREADS)
+		{
+			shards.back()->worker.reset(new FSThreadPool(1));
+		}
+	}
+} // end constructor
+
+bool ShardedFilesystemTree::create(const std::string& pName, int pType,
+	const std::string& parentPath)
+{
+	bool rValue = false;
+	int shardIndex = shardFor(pName, parentPath);
+
+	runOn(shardIndex, [&]()
+	{
+		rValue = shards[shardIndex]->tree.create(pName, pType, parentPath);
+	});
+
+	return rValue;
+} // end create
+
+bool ShardedFilesystemTree::remove(const std::string& pName, const std::string& parentPath)
+{
+	bool rValue = false;
+	int shardIndex = shardFor(pName, parentPath);
+
+	runOn(shardIndex, [&]()
+	{
+		rValue = shards[shardIndex]->tree.remove(pName, parentPath);
+	});
+
+	return rValue;
+} // end remove
+
+bool ShardedFilesystemTree::move(const std::string& pName, const std::string& sourcePath,
+	const std::string& destPath)
+{
+	bool rValue = false;
+	int sourceShard = shardFor(pName, sourcePath);
+	int destShard = shardFor(pName, destPath);
+	Shard& source = *shards[sourceShard];
+	Shard& dest = *shards[destShard];
+
+	if (sourceShard == destShard)
+	{
+		runOn(sourceShard, [&]()
+		{
+			rValue = source.tree.move(pName, sourcePath, destPath);
+		});
+	}
+	else
+	{
+		runExclusive(sourceShard, destShard, [&]()
+		{
+			rValue = transfer(pName, source, sourcePath, dest, destPath, false);
+		});
+	}
+
+	return rValue;
+} // end move
+
+bool ShardedFilesystemTree::copy(const std::string& pName, const std::string& sourcePath,
+	const std::string& destPath)
+{
+	bool rValue = false;
+	int sourceShard = shardFor(pName, sourcePath);
+	int destShard = shardFor(pName, destPath);
+	Shard& source = *shards[sourceShard];
+	Shard& dest = *shards[destShard];
+
+	if (sourceShard == destShard)
+	{
+		runOn(sourceShard, [&]()
+		{
+			rValue = source.tree.copy(pName, sourcePath, destPath);
+		});
+	}
+	else
+	{
+		runExclusive(sourceShard, destShard, [&]()
+		{
+			rValue = transfer(pName, source, sourcePath, dest, destPath, true);
+		});
+	}
+
+	return rValue;
+} // end copy
+
+int ShardedFilesystemTree::find(const std::string& pName, const std::string& startPath,
+	std::ostream& outStream)
+{
+	int matches = 0;
+	int startShard = shardOf(startPath);
+
+	if (startShard >= 0)
+	{
+		runOn(startShard, [&]()
+		{
+			matches = shards[startShard]->tree.find(pName, startPath, outStream);
+		});
+	}
+	else
+	{
+		// Every shard searches its part into its own buffer
+		std::vector<std::ostringstream> found(shards.size());
+		std::vector<int> counts(shards.size(), 0);
+
+		runOnAll([&](int shardIndex)
+		{
+			counts[shardIndex] = shards[shardIndex]->tree.find(pName, startPath,
+				found[shardIndex]);
+		});
+
+		for (unsigned int i = 0; i < shards.size(); i++)
+		{
+			outStream << found[i].str();
+			matches += counts[i];
+		}
+	}
+
+	return matches;
+} // end find
+
+void ShardedFilesystemTree::displayStats(std::ostream& outStream)
+{
+	std::vector<std::pair<int, int>> counts(shards.size());
+	std::pair<int, int> total = { 0,0 };
+
+	runOnAll([&](int shardIndex)
+	{
+		FilesystemTree& tree = shards[shardIndex]->tree;
+		counts[shardIndex] = tree.recursiveStats(tree.rootPtr);
+	});
+
+	for (const std::pair<int, int>& count : counts)
+	{
+		total.first += count.first;
+		total.second += count.second;
+	}
+
+	outStream << "Directories: " << total.first << std::endl;
+	outStream << "Files: " << total.second << std::endl;
+} // end displayStats
+
+bool ShardedFilesystemTree::format()
+{
+	std::vector<char> formatted(shards.size(), false);
+
+	runOnAll([&](int shardIndex)
+	{
+		formatted[shardIndex] = shards[shardIndex]->tree.format();
+	});
+
+	return std::find(formatted.begin(), formatted.end(), false) == formatted.end();
+} // end format
+
+int ShardedFilesystemTree::getShardCount() const
+{
+	return shards.size();
+} // end getShardCount
+
+int ShardedFilesystemTree::shardOf(const std::string& path) const
+{
+	std::vector<std::string> names;
+	int shardIndex = -1;
+
+	// Parse as the trees do, so every spelling they accept for a path
+	// reaches the shard holding it
+	if (FilesystemTree::splitPath(path, names) && !names.empty() && !names[0].empty())
+	{
+		shardIndex = shardOfName(names[0]);
+	}
+
+	return shardIndex;
+} // end shardOf
+
+int ShardedFilesystemTree::shardOfName(const std::string& pName) const
+{
+	// Route by the name as stored, so every spelling that reaches the same
+	// entry reaches the same shard
+	return std::hash<std::string>()(FSNode::cleanName(pName)) % shards.size();
+} // end shardOfName
+
+int ShardedFilesystemTree::shardFor(const std::string& pName,
+	const std::string& parentPath) const
+{
+	int shardIndex = shardOf(parentPath);
+
+	return (shardIndex >= 0) ? shardIndex : shardOfName(pName);
+} // end shardFor
+
+void ShardedFilesystemTree::runOn(int shardIndex, const std::function<void()>& task)
+{
+	if (shards[shardIndex]->worker == nullptr)
+	{
+		task();
+	}
+	else
+	{
+		shards[shardIndex]->worker->submit(task).get();
+	}
+} // end runOn
+
+void ShardedFilesystemTree::runOnAll(const std::function<void(int)>& task)
+{
+	std::vector<std::future<void>> done;
+
+	for (unsigned int i = 0; i < shards.size(); i++)
+	{
+		if (shards[i]->worker == nullptr)
+		{
+			task(i);
+		}
+		else
+		{
+			done.push_back(shards[i]->worker->submit([&task, i]() { task(i); }));
+		}
+	}
+
+	// Every task must finish before task and what it refers to go away,
+	// so a failure is only rethrown once all of them have
+	std::exception_ptr failure = nullptr;
+
+	for (std::future<void>& result : done)
+	{
+		try
+		{
+			result.get();
+		}
+		catch (...)
+		{
+			if (failure == nullptr)
+			{
+				failure = std::current_exception();
+			}
+		}
+	}
+
+	if (failure != nullptr)
+	{
+		std::rethrow_exception(failure);
+	}
+} // end runOnAll
+
+void ShardedFilesystemTree::runExclusive(int firstShard, int secondShard,
+	const std::function<void()>& work)
+{
+	// Phase one: park the workers, lower shard first
+	int order[2] = { std::min(firstShard, secondShard), std::max(firstShard, secondShard) };
+	std::promise<void> parked[2];
+	std::promise<void> release;
+	std::shared_future<void> released = release.get_future().share();
+	std::vector<std::future<void>> done;
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (shards[order[i]]->worker != nullptr)
+		{
+			std::promise<void>& shardParked = parked[i];
+
+			done.push_back(shards[order[i]]->worker->submit([&shardParked, released]()
+			{
+				shardParked.set_value();
+				released.wait();
+			}));
+			shardParked.get_future().wait();
+		}
+	}
+
+	// Phase two: change both trees while nothing else can, then resume
+	try
+	{
+		work();
+	}
+	catch (...)
+	{
+		release.set_value();
+		throw;
+	}
+
+	release.set_value();
+	for (std::future<void>& result : done)
+	{
+		result.get();
+	}
+} // end runExclusive
+
+bool ShardedFilesystemTree::transfer(const std::string& pName, Shard& source,
+	const std::string& sourcePath, Shard& dest, const std::string& destPath,
+	bool keepSource)
+{
+	bool rValue = false;
+	std::shared_ptr<FSNode> sourceParentPtr = source.tree.pathToPointer(sourcePath);
+
+	if (pName != ROOT_NAME && sourceParentPtr != nullptr
+		&& sourceParentPtr->getChild(pName) != nullptr)
+	{
+		// A moved subtree changes owner as it is; a copied one is duplicated
+		std::shared_ptr<FSNode> nodePtr = sourceParentPtr->getChild(pName);
+		if (keepSource)
+		{
+			nodePtr = source.tree.copySubTree(nodePtr);
+		}
+
+		rValue = dest.tree.adopt(nodePtr, destPath);
+
+		if (rValue && !keepSource)
+		{
+			source.tree.remove(pName, sourcePath);
+		}
+	}
+
+	return rValue;
+} // end transfer
@@ -0,0 +1,136 @@
+#ifndef SHARDEDFILESYSTEMTREE
+#define SHARDEDFILESYSTEMTREE
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FilesystemTree.h"
+#include "FSThreadPool.h"
+
+/*
+* ShardedFilesystemTree spreads one namespace over several FilesystemTrees so
+* operations on different top-level directories run in parallel. Each
+* entry directly below ROOT_NAME, with everything under it, lives in the
+* shard chosen by hashing its name. Each shard is owned by one worker
+* thread, and only that thread touches the shard's tree.
+*
+* Every public function is safe to call from any number of threads at
+* once. A call waits for its result.
+* - An operation inside one shard is queued to that shard's worker and
+*   shares nothing with the other shards.
+* - A move or copy between shards is two-phase. First both workers are
+*   parked, always in shard order so two such calls cannot deadlock. Then
+*   the node is handed over directly and both workers are released. Other
+*   callers therefore see the change as a single step.
+* - Calls on ROOT_NAME itself (find, displayStats, format) go to every
+*   shard at once and their answers are combined.
+*
+* Built with FS_SINGLE_THREADED there are no workers: calls run on the
+* caller's thread and must not overlap.
+*/
+class ShardedFilesystemTree
+{
+public:
+
+	/*
+	* Constructor which creates the shards, each with an empty tree.
+	* Throws std::runtime_error if shardCount is less than 1.
+	*
+	* @param shardCount Number of shards (and worker threads).
+	*/
+	ShardedFilesystemTree(int shardCount);
+
+	ShardedFilesystemTree(const ShardedFilesystemTree&) = delete;
+	ShardedFilesystemTree& operator=(const ShardedFilesystemTree&) = delete;
+
+	/*
+	* create(), remove(), move(), copy() and find() behave like the
+	* FilesystemTree functions of the same name. find() started at ROOT_NAME
+	* writes the matches of one shard after another, so their order differs
+	* from a single tree's.
+	*/
+	bool create(const std::string& pName, int pType, const std::string& parentPath);
+	bool remove(const std::string& pName, const std::string& parentPath);
+	bool move(const std::string& pName, const std::string& sourcePath,
+		const std::string& destPath);
+	bool copy(const std::string& pName, const std::string& sourcePath,
+		const std::string& destPath);
+	int find(const std::string& pName, const std::string& startPath,
+		std::ostream& outStream);
+
+	/*
+	* displayStats() displays the total file and directory counts of all
+	* shards, in the same format as FilesystemTree::displayStats().
+	*/
+	void displayStats(std::ostream& outStream);
+
+	/*
+	* format() erases every shard.
+	*
+	* @return True if successful, false if not.
+	*/
+	bool format();
+
+	/*
+	* @return The number of shards.
+	*/
+	int getShardCount() const;
+
+	/*
+	* shardOf() tells which shard holds a path. Paths directly on ROOT_NAME
+	* have no shard of their own.
+	*
+	* @return The shard index, or -1 for ROOT_NAME.
+	*/
+	int shardOf(const std::string& path) const;
+
+private:
+
+	// A tree and the one worker allowed to touch it
+	struct Shard
+	{
+		FilesystemTree tree;
+		std::unique_ptr<FSThreadPool> worker; // nullptr if FS_SINGLE_THREADED
+	};
+
+	/*
+	* shardOfName() picks the shard for an entry directly below ROOT_NAME.
+	*/
+	int shardOfName(const std::string& pName) const;
+
+	/*
+	* shardFor() picks the shard holding pName inside parentPath.
+	*/
+	int shardFor(const std::string& pName, const std::string& parentPath) const;
+
+	/*
+	* runOn() runs task on a shard's worker and waits for it to finish.
+	*/
+	void runOn(int shardIndex, const std::function<void()>& task);
+
+	/*
+	* runOnAll() runs task(shardIndex) on every shard at once and waits for
+	* all of them.
+	*/
+	void runOnAll(const std::function<void(int)>& task);
+
+	/*
+	* runExclusive() parks the workers of two shards, runs work on the
+	* calling thread while both are idle, then lets them go again.
+	*/
+	void runExclusive(int firstShard, int secondShard, const std::function<void()>& work);
+
+	/*
+	* transfer() moves or copies pName from one shard's tree to another's.
+	* Both workers must be parked.
+	*/
+	bool transfer(const std::string& pName, Shard& source, const std::string& sourcePath,
+		Shard& dest, const std::string& destPath, bool keepSource);
+
+	std::vector<std::unique_ptr<Shard>> shards;
+
+}; // end ShardedFilesystemTree
+
+#endif
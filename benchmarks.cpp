@@ -0,0 +1,735 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "FSNode.h"
+#include "FilesystemTree.h"
+#include "ShardedFilesystemTree.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Usage: benchmarks [--large] [name]
+//
+// Runs every benchmark, or only the one given by name. --large adds the
+// export of a tree with more than a million nodes, which takes a few seconds
+// to build and several hundred MB of memory. Each measurement is
+// the best of BENCH_REPEATS runs. Build with the definitions described in
+// FSPolicy.h to compare policy variants. Where the kernel allows it, the
+// compact benchmark also reads cache and TLB miss counters with
+// perf_event_open; otherwise run it under "perf stat -e cache-misses".
+
+const int BENCH_REPEATS = 5;
+
+// Tree shapes used by the benchmarks
+const int WIDE_FILES = 20000; // files in a single directory
+const int DEEP_LEVELS = 2000; // nested directories, one file each
+const int BALANCED_FANOUT = 8; // subdirectories per directory
+const int BALANCED_LEVELS = 5; // levels of subdirectories
+const int BALANCED_FILES = 2; // files per directory
+const int LARGE_FANOUT = 10; // --large: subdirectories per directory
+const int LARGE_LEVELS = 5; // --large: levels of subdirectories
+const int LARGE_FILES = 10; // --large: files per directory, 1.2M nodes in all
+
+// Sharded tree scaling benchmark
+const int SHARD_COUNTS[] = { 1, 2, 4, 8 };
+const int SHARDED_TOP_DIRS = 64; // top-level directories, spread over shards
+const int SHARDED_SUBDIRS = 8; // directories in each top-level directory
+const int SHARDED_FILES = 8; // files in each of those
+const int SHARDED_CLIENTS = 8; // threads calling the sharded tree
+const int SHARDED_OPS = 2000; // find/create/remove rounds per client
+
+// Watch benchmark
+const int WATCH_SAME_PATH = 1000; // watchers on the changed directory itself
+
+// Compaction benchmark
+const int COMPACT_SLICE_NODES = 1024; // budget of each compactStep()
+const int SCATTER_JUNK_BYTES = 256; // largest filler allocation between nodes
+
+/*
+* bestMillis() runs work BENCH_REPEATS times and returns the fastest run.
+*/
+double bestMillis(const std::function<void()>& work)
+{
+	double best = 0.0;
+
+	for (int i = 0; i < BENCH_REPEATS; i++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		work();
+		double elapsed = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+
+		best = (i == 0) ? elapsed : std::min(best, elapsed);
+	}
+
+	return best;
+}
+
+void report(const std::string& name, double millis, const std::string& note = "")
+{
+	std::cout << std::left << std::setw(40) << name << std::right
+		<< std::fixed << std::setprecision(3) << std::setw(12) << millis
+		<< " ms" << note << std::endl;
+}
+
+/*
+* Builders for the benchmark shapes. Each creates the shape in a new
+* directory named shape directly below ROOT_NAME.
+*/
+void buildWide(FilesystemTree& tree)
+{
+	std::string path = ROOT_NAME + SEPARATING_CHAR + "shape";
+
+	tree.create("shape", DIR_TYPE, ROOT_NAME);
+	for (int i = 0; i < WIDE_FILES; i++)
+	{
+		tree.create("f" + std::to_string(i), FILE_TYPE, path);
+	}
+}
+
+void buildDeep(FilesystemTree& tree)
+{
+	std::string path = ROOT_NAME;
+	std::string name = "shape";
+
+	for (int i = 0; i < DEEP_LEVELS; i++)
+	{
+		tree.create(name, DIR_TYPE, path);
+		path += SEPARATING_CHAR + name;
+		tree.create("f" + std::to_string(i), FILE_TYPE, path);
+		name = "d" + std::to_string(i);
+	}
+}
+
+std::string balancedName(int levels, int index)
+{
+	return "l" + std::to_string(levels) + "d" + std::to_string(index);
+}
+
+void buildBalancedLevel(FilesystemTree& tree, const std::string& path, int levels,
+	int fanout, int files)
+{
+	for (int i = 0; i < files; i++)
+	{
+		tree.create("f" + std::to_string(i), FILE_TYPE, path);
+	}
+
+	if (levels > 0)
+	{
+		for (int i = 0; i < fanout; i++)
+		{
+			// create() refuses a child named like its parent, so names
+			// carry the level as well
+			std::string name = balancedName(levels, i);
+
+			tree.create(name, DIR_TYPE, path);
+			buildBalancedLevel(tree, path + SEPARATING_CHAR + name, levels - 1,
+				fanout, files);
+		}
+	}
+}
+
+void buildBalanced(FilesystemTree& tree)
+{
+	tree.create("shape", DIR_TYPE, ROOT_NAME);
+	buildBalancedLevel(tree, ROOT_NAME + SEPARATING_CHAR + "shape", BALANCED_LEVELS,
+		BALANCED_FANOUT, BALANCED_FILES);
+}
+
+void buildLarge(FilesystemTree& tree)
+{
+	tree.create("shape", DIR_TYPE, ROOT_NAME);
+	buildBalancedLevel(tree, ROOT_NAME + SEPARATING_CHAR + "shape", LARGE_LEVELS,
+		LARGE_FANOUT, LARGE_FILES);
+}
+
+const struct
+{
+	const char* name;
+	void (*build)(FilesystemTree&);
+} SHAPES[] = {
+	{ "wide", buildWide },
+	{ "deep", buildDeep },
+	{ "balanced", buildBalanced },
+};
+
+// Set by --large: benchExport() also exports the large shape
+bool largeShapes = false;
+
+/*
+* benchCopy() times copy() of each shape into a sibling directory and a
+* whole-tree copy via the copy constructor.
+*/
+void benchCopy()
+{
+	for (const auto& shape : SHAPES)
+	{
+		FilesystemTree tree;
+		shape.build(tree);
+
+		report(std::string("copy/") + shape.name, bestMillis([&]()
+		{
+			tree.create("target", DIR_TYPE, ROOT_NAME);
+			tree.copy("shape", ROOT_NAME, ROOT_NAME + SEPARATING_CHAR + "target");
+			tree.remove("target", ROOT_NAME);
+		}));
+
+		report(std::string("copy-constructor/") + shape.name, bestMillis([&]()
+		{
+			FilesystemTree treeCopy(tree);
+		}));
+	}
+}
+
+/*
+* CountingBuffer discards everything written to it but counts the bytes, so
+* output benchmarks measure serialization rather than the sink.
+*/
+class CountingBuffer : public std::streambuf
+{
+public:
+	std::size_t bytes = 0;
+
+protected:
+	int_type overflow(int_type c) override
+	{
+		bytes++;
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char*, std::streamsize count) override
+	{
+		bytes += count;
+		return count;
+	}
+};
+
+/*
+* benchExport() times exportTree() of each shape in every format and reports
+* the output rate, adding the large shape when largeShapes is set.
+*/
+void benchExport()
+{
+	const struct
+	{
+		const char* name;
+		int format;
+	} FORMATS[] = {
+		{ "json", EXPORT_JSON },
+		{ "ndjson", EXPORT_NDJSON },
+		{ "csv", EXPORT_CSV },
+	};
+
+	std::vector<std::pair<const char*, void (*)(FilesystemTree&)>> shapes;
+
+	for (const auto& shape : SHAPES)
+	{
+		shapes.push_back(std::make_pair(shape.name, shape.build));
+	}
+	if (largeShapes)
+	{
+		shapes.push_back(std::make_pair("large", buildLarge));
+	}
+
+	for (const auto& shape : shapes)
+	{
+		FilesystemTree tree;
+		shape.second(tree);
+
+		for (const auto& format : FORMATS)
+		{
+			CountingBuffer buffer;
+			std::ostream out(&buffer);
+
+			double millis = bestMillis([&]()
+			{
+				buffer.bytes = 0;
+				tree.exportTree(ROOT_NAME, format.format, out);
+			});
+
+			report(std::string("export/") + format.name + "/" + shape.first, millis,
+				"  " + std::to_string(static_cast<int>(buffer.bytes / millis / 1000.0))
+				+ " MB/s");
+		}
+	}
+}
+
+/*
+* benchFind() times find() from the root for a name that occurs once in each
+* shape and for one that does not occur, where the subtree filters let
+* find() skip the most.
+*/
+void benchFind()
+{
+	const struct
+	{
+		const char* shape;
+		const char* name;
+	} TARGETS[] = {
+		{ "wide", "f19999" },
+		{ "deep", "f1999" },
+		{ "balanced", "l5d7" },
+	};
+
+	for (int i = 0; i < 3; i++)
+	{
+		FilesystemTree tree;
+		SHAPES[i].build(tree);
+
+		CountingBuffer buffer;
+		std::ostream out(&buffer);
+
+		report(std::string("find-once/") + SHAPES[i].name, bestMillis([&]()
+		{
+			for (int j = 0; j < 100; j++)
+			{
+				tree.find(TARGETS[i].name, ROOT_NAME, out);
+			}
+		}));
+
+		report(std::string("find-missing/") + SHAPES[i].name, bestMillis([&]()
+		{
+			for (int j = 0; j < 100; j++)
+			{
+				tree.find("missing", ROOT_NAME, out);
+			}
+		}));
+	}
+}
+
+/*
+* reportMemory() prints the bytes per node of each memoryUsage() category.
+*/
+void reportMemory(const std::string& name, const FSMemoryUsage& usage)
+{
+	double nodes = static_cast<double>(std::max<std::size_t>(usage.nodes, 1));
+
+	std::cout << std::left << std::setw(40) << name << std::right
+		<< std::fixed << std::setprecision(1) << std::setw(12)
+		<< usage.total() / nodes << " B/node  (headers "
+		<< usage.nodeHeaders / nodes << ", names " << usage.names / nodes
+		<< ", children " << usage.childArrays / nodes << " incl. slack "
+		<< usage.childSlack / nodes << ", indexes " << usage.indexes / nodes
+		<< ", caches " << usage.caches / nodes << ", arena slack "
+		<< usage.arenaSlack / nodes << ", mapped "
+		<< usage.mapped / nodes << ")" << std::endl;
+}
+
+/*
+* benchMemory() reports the memory per node of each shape as built and
+* after shrink(), and times shrink().
+*/
+void benchMemory()
+{
+	for (const auto& shape : SHAPES)
+	{
+		FilesystemTree tree;
+		shape.build(tree);
+
+		reportMemory(std::string("memory/") + shape.name, tree.memoryUsage());
+
+		std::size_t freed = 0;
+		double millis = bestMillis([&]()
+		{
+			freed += tree.shrink(); // only the first run has slack to free
+		});
+		report(std::string("shrink/") + shape.name, millis,
+			"  " + std::to_string(freed) + " bytes freed");
+
+		reportMemory(std::string("memory-shrunk/") + shape.name, tree.memoryUsage());
+	}
+}
+
+/*
+* benchSharded() runs SHARDED_CLIENTS threads against a ShardedFilesystemTree
+* with each shard count. Every round a client searches one top-level
+* directory and creates and removes a file in it, so rounds on different
+* shards never share state and throughput should grow with the shard count
+* up to the number of cores.
+*/
+void benchSharded()
+{
+	for (int shardCount : SHARD_COUNTS)
+	{
+		ShardedFilesystemTree tree(shardCount);
+
+		for (int i = 0; i < SHARDED_TOP_DIRS; i++)
+		{
+			std::string topPath = ROOT_NAME + SEPARATING_CHAR + "top" + std::to_string(i);
+
+			tree.create("top" + std::to_string(i), DIR_TYPE, ROOT_NAME);
+			for (int j = 0; j < SHARDED_SUBDIRS; j++)
+			{
+				tree.create("d" + std::to_string(j), DIR_TYPE, topPath);
+				for (int k = 0; k < SHARDED_FILES; k++)
+				{
+					tree.create("f" + std::to_string(k), FILE_TYPE,
+						topPath + SEPARATING_CHAR + "d" + std::to_string(j));
+				}
+			}
+		}
+
+		double millis = bestMillis([&]()
+		{
+			std::vector<std::thread> clients;
+
+			for (int c = 0; c < SHARDED_CLIENTS; c++)
+			{
+				clients.emplace_back([&tree, c]()
+				{
+					CountingBuffer buffer;
+					std::ostream out(&buffer);
+					std::string name = "c" + std::to_string(c);
+
+					for (int i = 0; i < SHARDED_OPS; i++)
+					{
+						std::string topPath = ROOT_NAME + SEPARATING_CHAR + "top"
+							+ std::to_string((c + i * SHARDED_CLIENTS) % SHARDED_TOP_DIRS);
+
+						tree.find("f1", topPath, out);
+						tree.create(name, FILE_TYPE, topPath);
+						tree.remove(name, topPath);
+					}
+				});
+			}
+			for (std::thread& client : clients)
+			{
+				client.join();
+			}
+		});
+
+		double calls = 3.0 * SHARDED_CLIENTS * SHARDED_OPS;
+		report("sharded/" + std::to_string(shardCount) + "-shards", millis,
+			"  " + std::to_string(static_cast<long>(calls / millis * 1000.0)) + " calls/s");
+	}
+}
+
+/*
+* PerfCounters reads the hardware cache-miss and dTLB-load-miss counters of
+* this thread for one run of a piece of work. Does nothing if the kernel
+* does not allow perf_event_open (e.g. in most containers).
+*/
+class PerfCounters
+{
+public:
+	PerfCounters()
+	{
+		fds[0] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		fds[1] = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	~PerfCounters()
+	{
+		for (int fd : fds)
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+	}
+
+	/*
+	* measure() runs work once with the counters on.
+	*
+	* @return The counts as a note for report().
+	*/
+	std::string measure(const std::function<void()>& work)
+	{
+		std::uint64_t counts[2] = { 0, 0 };
+
+		if (fds[0] < 0 && fds[1] < 0)
+		{
+			return "  (perf counters unavailable)";
+		}
+
+		for (int fd : fds)
+		{
+			if (fd >= 0)
+			{
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+		work();
+		for (int i = 0; i < 2; i++)
+		{
+			if (fds[i] >= 0)
+			{
+				ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+				if (read(fds[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i]))
+				{
+					counts[i] = 0;
+				}
+			}
+		}
+
+		return "  cache-misses " + (fds[0] >= 0 ? std::to_string(counts[0]) : "n/a")
+			+ ", dTLB-load-misses " + (fds[1] >= 0 ? std::to_string(counts[1]) : "n/a");
+	}
+
+private:
+	static int open(std::uint32_t type, std::uint64_t config)
+	{
+		perf_event_attr attr;
+
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	int fds[2];
+};
+
+/*
+* buildScattered() creates the balanced shape the way a long-lived tree
+* grows: directories level by level, then files in random directories in
+* random order, with unrelated allocations kept alive in between. Nodes that
+* are neighbours in a traversal end up far apart on the heap.
+*/
+void buildScattered(FilesystemTree& tree, std::vector<std::unique_ptr<char[]>>& junk)
+{
+	std::mt19937 random(1);
+	std::vector<std::string> dirPaths;
+	std::deque<std::pair<std::string, int>> pending;
+
+	tree.create("shape", DIR_TYPE, ROOT_NAME);
+	pending.push_back({ ROOT_NAME + SEPARATING_CHAR + "shape", BALANCED_LEVELS });
+
+	while (!pending.empty())
+	{
+		std::pair<std::string, int> dir = pending.front();
+		pending.pop_front();
+		dirPaths.push_back(dir.first);
+
+		for (int i = 0; dir.second > 0 && i < BALANCED_FANOUT; i++)
+		{
+			std::string name = balancedName(dir.second, i);
+
+			tree.create(name, DIR_TYPE, dir.first);
+			pending.push_back({ dir.first + SEPARATING_CHAR + name, dir.second - 1 });
+			junk.emplace_back(new char[1 + random() % SCATTER_JUNK_BYTES]);
+		}
+	}
+
+	std::vector<std::pair<int, int>> files;
+	for (unsigned int i = 0; i < dirPaths.size(); i++)
+	{
+		for (int j = 0; j < BALANCED_FILES; j++)
+		{
+			files.push_back({ i, j });
+		}
+	}
+	std::shuffle(files.begin(), files.end(), random);
+
+	for (const std::pair<int, int>& file : files)
+	{
+		tree.create("f" + std::to_string(file.second), FILE_TYPE, dirPaths[file.first]);
+		junk.emplace_back(new char[1 + random() % SCATTER_JUNK_BYTES]);
+	}
+}
+
+/*
+* benchTraversals() times the full-tree traversals of tree and reads the
+* hardware counters for one more run of each.
+*/
+void benchTraversals(FilesystemTree& tree, const std::string& suffix)
+{
+	PerfCounters counters;
+	CountingBuffer buffer;
+	std::ostream out(&buffer);
+
+	const struct
+	{
+		const char* name;
+		std::function<void()> work;
+	} TRAVERSALS[] = {
+		{ "find", [&]() { tree.find("f0", ROOT_NAME, out); } },
+		{ "stats", [&]() { tree.displayStats(out); } },
+		{ "display", [&]() { tree.displayTree(out); } },
+		{ "copy-constructor", [&]() { FilesystemTree treeCopy(tree); } },
+	};
+
+	for (const auto& traversal : TRAVERSALS)
+	{
+		double millis = bestMillis(traversal.work);
+		report(std::string(traversal.name) + suffix, millis,
+			counters.measure(traversal.work));
+	}
+}
+
+/*
+* benchCompact() compares traversals of a scattered tree before and after
+* compact(), and times compacting stop-the-world and in compactStep()
+* slices.
+*/
+void benchCompact()
+{
+	std::vector<std::unique_ptr<char[]>> junk;
+	FilesystemTree tree;
+
+	buildScattered(tree, junk);
+	benchTraversals(tree, "/scattered");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	tree.compact();
+	report("compact", std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count());
+
+	benchTraversals(tree, "/compacted");
+
+	// Incremental compaction of a second scattered tree
+	FilesystemTree sliced;
+	double longestSlice = 0.0;
+	int slices = 0;
+	bool done = false;
+
+	buildScattered(sliced, junk);
+	start = std::chrono::steady_clock::now();
+	while (!done)
+	{
+		std::chrono::steady_clock::time_point sliceStart = std::chrono::steady_clock::now();
+		done = sliced.compactStep(COMPACT_SLICE_NODES);
+		longestSlice = std::max(longestSlice, std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - sliceStart).count());
+		slices++;
+	}
+	report("compact-sliced", std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count(),
+		"  " + std::to_string(slices) + " slices, longest "
+		+ std::to_string(longestSlice) + " ms");
+}
+
+/*
+* benchWatch() times create()/remove() pairs deep in the balanced shape with
+* no watchers, then with a watcher on every directory except the changed
+* one's ancestors, to show matching does not grow with the watcher count.
+* Finally WATCH_SAME_PATH watchers on the changed directory itself show that
+* delivery stays linear in the number of matching watchers.
+*/
+void benchWatch()
+{
+	FilesystemTree tree;
+	std::string path = ROOT_NAME + SEPARATING_CHAR + "shape";
+	int watcherCount = 0;
+	int delivered = 0;
+
+	buildBalanced(tree);
+	for (int i = BALANCED_LEVELS; i > 0; i--)
+	{
+		path += SEPARATING_CHAR + balancedName(i, 0);
+	}
+
+	auto work = [&]()
+	{
+		for (int i = 0; i < 10000; i++)
+		{
+			tree.create("w", FILE_TYPE, path);
+			tree.remove("w", path);
+		}
+	};
+
+	report("watch/none", bestMillis(work));
+
+	// Watch every directory in the subtrees of all but the first top-level
+	// directory of the shape
+	std::function<void(const std::string&, int)> watchLevel
+		= [&](const std::string& dirPath, int levels)
+	{
+		tree.watch(dirPath, true, [&](const FSEvent&) { delivered++; });
+		watcherCount++;
+		for (int i = 0; levels > 0 && i < BALANCED_FANOUT; i++)
+		{
+			watchLevel(dirPath + SEPARATING_CHAR + balancedName(levels, i), levels - 1);
+		}
+	};
+	for (int i = 1; i < BALANCED_FANOUT; i++)
+	{
+		watchLevel(ROOT_NAME + SEPARATING_CHAR + "shape" + SEPARATING_CHAR
+			+ balancedName(BALANCED_LEVELS, i), BALANCED_LEVELS - 1);
+	}
+
+	report("watch/" + std::to_string(watcherCount) + "-unrelated", bestMillis(work));
+
+	tree.watch(ROOT_NAME, true, [&](const FSEvent&) { delivered++; });
+	double millis = bestMillis(work);
+	report("watch/" + std::to_string(watcherCount) + "-unrelated+root",
+		millis, "  " + std::to_string(delivered) + " delivered");
+
+	for (int i = 0; i < WATCH_SAME_PATH; i++)
+	{
+		tree.watch(path, false, [&](const FSEvent&) { delivered++; });
+	}
+	delivered = 0;
+	millis = bestMillis(work);
+	report("watch/" + std::to_string(WATCH_SAME_PATH) + "-same-path",
+		millis, "  " + std::to_string(delivered) + " delivered");
+}
+
+const struct
+{
+	const char* name;
+	void (*run)();
+} BENCHMARKS[] = {
+	{ "copy", benchCopy },
+	{ "export", benchExport },
+	{ "find", benchFind },
+	{ "memory", benchMemory },
+	{ "sharded", benchSharded },
+	{ "compact", benchCompact },
+	{ "watch", benchWatch },
+};
+
+int main(int argc, char* argv[])
+{
+	std::string only;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--large") == 0)
+		{
+			largeShapes = true;
+		}
+		else
+		{
+			only = argv[i];
+		}
+	}
+
+	std::cout << "Names: " << FSNamePolicy::NAME << ", children: " << FSChildPolicy::NAME
+		<< ", threads: " << (FS_USE_THREADS ? "on" : "off") << std::endl;
+
+	for (const auto& benchmark : BENCHMARKS)
+	{
+		if (only.empty() || only == benchmark.name)
+		{
+			benchmark.run();
+		}
+	}
+
+	return 0;
+}
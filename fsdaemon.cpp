@@ -0,0 +1,70 @@
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "FilesystemTree.h"
+#include "FilesystemServer.h"
+
+// Usage: fsdaemon <socketPath> [inputFile] [traceFile]
+//
+// Loads the tree once (from inputFile if given and not "-", otherwise empty)
+// and serves it on socketPath until SIGINT or SIGTERM. If traceFile is given
+// every request is recorded to it for the replay tool.
+
+FilesystemServer* activeServer = nullptr;
+
+void handleSignal(int)
+{
+	if (activeServer != nullptr)
+	{
+		activeServer->stop();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <socketPath> [inputFile] [traceFile]"
+			<< std::endl;
+		return 1;
+	}
+
+	try
+	{
+		std::shared_ptr<FilesystemTree> treePtr = (argc > 2 && std::string(argv[2]) != "-")
+			? std::make_shared<FilesystemTree>(argv[2])
+			: std::make_shared<FilesystemTree>();
+		FilesystemServer server(*treePtr, argv[1]);
+
+		if (argc > 3)
+		{
+			treePtr->startTrace(argv[3]);
+		}
+
+		activeServer = &server;
+		std::signal(SIGINT, handleSignal);
+		std::signal(SIGTERM, handleSignal);
+
+		std::cout << "Serving on " << argv[1] << std::endl;
+		server.run();
+		activeServer = nullptr;
+
+		std::cout << "Served " << server.getRequestCount() << " requests in "
+			<< server.getBatchCount() << " batches." << std::endl;
+
+		if (argc > 3)
+		{
+			std::cout << "Traced " << treePtr->stopTrace() << " calls to "
+				<< argv[3] << "." << std::endl;
+		}
+	}
+	catch (const std::runtime_error& error)
+	{
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "FSNode.h"
+#include "FilesystemTree.h"
+#include "FSProtocol.h"
+
+// Usage: loadgen <socketPath> [secondsPerRun] [pipelineDepth]
+//
+// Load generator for fsdaemon. For several client counts it opens one
+// connection per client thread and repeatedly sends pipelineDepth requests
+// in a single write, then waits for all of the responses. Each request cycles
+// through create, find, stats and remove of a per-client file so the tree
+// stays the same size. Reports requests per second and latency percentiles.
+
+typedef std::chrono::steady_clock Clock;
+
+const int CLIENT_COUNTS[] = { 1, 2, 4, 8, 16 };
+
+/*
+* connectTo() opens a blocking connection to the server.
+*
+* @return The socket descriptor, or -1 on failure.
+*/
+int connectTo(const std::string& socketPath)
+{
+	sockaddr_un address;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+	if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address),
+		sizeof(address)) < 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+/*
+* appendRequest() encodes the request with sequence number seq for client id.
+*/
+void appendRequest(std::string& buffer, int id, std::uint64_t seq)
+{
+	std::string name = "lg" + std::to_string(id);
+	std::size_t frameStart = beginFrame(buffer);
+
+	switch (seq % 4)
+	{
+	case 0:
+		appendU8(buffer, OP_CREATE);
+		appendU8(buffer, FILE_TYPE);
+		appendString(buffer, name);
+		appendString(buffer, ROOT_NAME);
+		break;
+	case 1:
+		appendU8(buffer, OP_FIND);
+		appendString(buffer, name);
+		appendString(buffer, ROOT_NAME);
+		break;
+	case 2:
+		appendU8(buffer, OP_STATS);
+		break;
+	default:
+		appendU8(buffer, OP_REMOVE);
+		appendString(buffer, name);
+		appendString(buffer, ROOT_NAME);
+		break;
+	}
+
+	endFrame(buffer, frameStart);
+}
+
+/*
+* runClient() sends pipelined batches until the deadline and records the
+* latency of every request in nanoseconds. Sets connectFailed if the server
+* could not be reached.
+*/
+void runClient(const std::string& socketPath, int id, int depth,
+	Clock::time_point deadline, std::vector<std::uint64_t>& latencies,
+	char& connectFailed)
+{
+	int fd = connectTo(socketPath);
+	std::string outBuffer;
+	std::string inBuffer;
+	std::uint64_t seq = 0;
+	char chunk[64 * 1024];
+	bool ok = (fd >= 0);
+
+	connectFailed = !ok;
+
+	while (ok && Clock::now() < deadline)
+	{
+		outBuffer.clear();
+		for (int i = 0; i < depth; i++)
+		{
+			appendRequest(outBuffer, id, seq++);
+		}
+
+		Clock::time_point sent = Clock::now();
+		ok = (write(fd, outBuffer.data(), outBuffer.size())
+			== static_cast<ssize_t>(outBuffer.size()));
+
+		// Read until every response of this batch has arrived
+		int received = 0;
+		while (ok && received < depth)
+		{
+			std::size_t pos = 0;
+
+			while (inBuffer.size() - pos >= FRAME_HEADER_SIZE
+				&& inBuffer.size() - pos - FRAME_HEADER_SIZE
+				>= peekFrameSize(inBuffer.data() + pos))
+			{
+				pos += FRAME_HEADER_SIZE + peekFrameSize(inBuffer.data() + pos);
+				latencies.push_back(std::chrono::duration_cast<
+					std::chrono::nanoseconds>(Clock::now() - sent).count());
+				received++;
+			}
+			inBuffer.erase(0, pos);
+
+			if (received < depth)
+			{
+				ssize_t bytes = read(fd, chunk, sizeof(chunk));
+				ok = (bytes > 0);
+				if (ok)
+				{
+					inBuffer.append(chunk, bytes);
+				}
+			}
+		}
+	}
+
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+}
+
+/*
+* percentile() returns the value at fraction p of the sorted samples.
+*/
+double percentile(const std::vector<std::uint64_t>& sorted, double p)
+{
+	if (sorted.empty())
+	{
+		return 0.0;
+	}
+
+	std::size_t index = static_cast<std::size_t>(p * (sorted.size() - 1));
+	return sorted[index] / 1000.0; // microseconds
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0]
+			<< " <socketPath> [secondsPerRun] [pipelineDepth]" << std::endl;
+		return 1;
+	}
+
+	std::string socketPath = argv[1];
+	double seconds = (argc > 2) ? std::stod(argv[2]) : 2.0;
+	int depth = (argc > 3) ? std::max(1, std::stoi(argv[3])) : 16;
+
+	std::cout << "clients  pipeline        req/s    p50(us)    p99(us)  p99.9(us)"
+		<< std::endl;
+
+	for (int clients : CLIENT_COUNTS)
+	{
+		std::vector<std::vector<std::uint64_t>> perClient(clients);
+		std::vector<char> connectFailed(clients, false);
+		std::vector<std::thread> threads;
+		Clock::time_point start = Clock::now();
+		Clock::time_point deadline = start + std::chrono::duration_cast<
+			Clock::duration>(std::chrono::duration<double>(seconds));
+
+		for (int i = 0; i < clients; i++)
+		{
+			threads.emplace_back(runClient, socketPath, i, depth, deadline,
+				std::ref(perClient[i]), std::ref(connectFailed[i]));
+		}
+		for (std::thread& t : threads)
+		{
+			t.join();
+		}
+
+		if (std::find(connectFailed.begin(), connectFailed.end(), true)
+			!= connectFailed.end())
+		{
+			std::cerr << "Could not connect to " << socketPath << "." << std::endl;
+			return 1;
+		}
+
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		std::vector<std::uint64_t> all;
+		for (const std::vector<std::uint64_t>& samples : perClient)
+		{
+			all.insert(all.end(), samples.begin(), samples.end());
+		}
+		std::sort(all.begin(), all.end());
+
+		std::cout << std::setw(7) << clients << std::setw(10) << depth
+			<< std::fixed << std::setprecision(0)
+			<< std::setw(13) << all.size() / elapsed
+			<< std::setprecision(1)
+			<< std::setw(11) << percentile(all, 0.50)
+			<< std::setw(11) << percentile(all, 0.99)
+			<< std::setw(11) << percentile(all, 0.999) << std::endl;
+	}
+
+	return 0;
+}
@@ -1,8 +1,19 @@
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "FSNode.h"
 #include "FilesystemTree.h"
+#include "FilesystemServer.h"
+#include "FSProtocol.h"
+#include "ShardedFilesystemTree.h"
 
 // All functions below used for FilesystemTree class testing
 void FSTInitialTest(std::shared_ptr<FilesystemTree> treePtr);
@@ -11,6 +22,18 @@ void FSTFindTest(std::shared_ptr<FilesystemTree> treePtr);
 void FSTCCTest(std::shared_ptr<FilesystemTree> treePtr);
 void FSTMoveTest(std::shared_ptr<FilesystemTree> treePtr);
 void FSTCopyTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTServerTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTSnapshotTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTParallelCopyTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTListTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTPolicyTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTExportTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTWatchTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTFilterFindTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTTraceTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTMemoryTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTShardedTest(std::shared_ptr<FilesystemTree> treePtr);
+void FSTCompactTest(std::shared_ptr<FilesystemTree> treePtr);
 
 int main()
 {
@@ -41,6 +64,45 @@ int main()
 	// Tests copy constructor and overloaded = and displays final stats. These
 	// require copySubTree().
 	//FSTCCTest(treePtr);
+
+	// The tests below each work on their own copy of the final tree, so they
+	// can be uncommented in any order once the ones above pass.
+
+	// Tests FilesystemServer and the request protocol.
+	//FSTServerTest(treePtr);
+
+	// Tests saveSnapshot() and openSnapshot().
+	//FSTSnapshotTest(treePtr);
+
+	// Tests copy() and the copy constructor on subtrees big enough to copy in parallel.
+	//FSTParallelCopyTest(treePtr);
+
+	// Tests list() and its cursors.
+	//FSTListTest(treePtr);
+
+	// Tests the name and threading policies picked in FSPolicy.h.
+	//FSTPolicyTest(treePtr);
+
+	// Tests exportTree() in every format.
+	//FSTExportTest(treePtr);
+
+	// Tests watch() and unwatch() with callbacks and event queues.
+	//FSTWatchTest(treePtr);
+
+	// Tests find() across removes and moves, which leave subtree filters stale.
+	//FSTFilterFindTest(treePtr);
+
+	// Tests recording a trace and reading it back.
+	//FSTTraceTest(treePtr);
+
+	// Tests memoryUsage() and shrink().
+	//FSTMemoryTest(treePtr);
+
+	// Tests ShardedFilesystemTree against the same tree split over shards.
+	//FSTShardedTest(treePtr);
+
+	// Tests compact() and compactStep() while the tree changes.
+	//FSTCompactTest(treePtr);
 }
 
 void FSTCCTest(std::shared_ptr<FilesystemTree> treePtr)
@@ -157,4 +219,791 @@ void FSTCopyTest(std::shared_ptr<FilesystemTree> treePtr)
 		<< "/dir1: "
 		<< treePtr->copy("file3", ROOT_NAME + "/dir1", ROOT_NAME + "/dir99")
 		<< " [should be 0]" << std::endl;
-}
\ No newline at end of file
+}
+
+void FSTServerTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING FILESYSTEMSERVER **" << std::endl << std::endl;
+
+	const std::string socketPath = "FSTServerTest.sock";
+	FilesystemTree tree(*treePtr);
+	FilesystemServer server(tree, socketPath);
+	std::thread serverThread(&FilesystemServer::run, &server);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+	connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+
+	// One pipelined batch: create, a duplicate create, find, stats, an
+	// unknown opcode and an over-long name
+	std::string requests;
+	std::size_t frameStart = beginFrame(requests);
+	appendU8(requests, OP_CREATE);
+	appendU8(requests, DIR_TYPE);
+	appendString(requests, "dir11");
+	appendString(requests, ROOT_NAME + "/dir1");
+	endFrame(requests, frameStart);
+
+	frameStart = beginFrame(requests);
+	appendU8(requests, OP_CREATE);
+	appendU8(requests, DIR_TYPE);
+	appendString(requests, "dir11");
+	appendString(requests, ROOT_NAME + "/dir1");
+	endFrame(requests, frameStart);
+
+	frameStart = beginFrame(requests);
+	appendU8(requests, OP_FIND);
+	appendString(requests, "dir11");
+	appendString(requests, ROOT_NAME);
+	endFrame(requests, frameStart);
+
+	frameStart = beginFrame(requests);
+	appendU8(requests, OP_STATS);
+	endFrame(requests, frameStart);
+
+	frameStart = beginFrame(requests);
+	appendU8(requests, 99);
+	endFrame(requests, frameStart);
+
+	// A name too long for a str field is left out, so the server refuses
+	// the request instead of creating a shortened name
+	frameStart = beginFrame(requests);
+	appendU8(requests, OP_CREATE);
+	appendU8(requests, FILE_TYPE);
+	std::cout << "Encode a 70000 character name: "
+		<< appendString(requests, std::string(70000, 'a')) << " [should be 0]" << std::endl;
+	appendString(requests, ROOT_NAME);
+	endFrame(requests, frameStart);
+
+	write(fd, requests.data(), requests.size());
+
+	// Read until all six responses have arrived
+	std::string responses;
+	std::vector<std::string> bodies;
+	char chunk[4096];
+
+	while (bodies.size() < 6)
+	{
+		ssize_t bytes = read(fd, chunk, sizeof(chunk));
+		if (bytes <= 0)
+		{
+			break;
+		}
+		responses.append(chunk, bytes);
+
+		while (responses.size() >= FRAME_HEADER_SIZE
+			&& responses.size() >= FRAME_HEADER_SIZE + peekFrameSize(responses.data()))
+		{
+			std::uint32_t bodySize = peekFrameSize(responses.data());
+			bodies.push_back(responses.substr(FRAME_HEADER_SIZE, bodySize));
+			responses.erase(0, FRAME_HEADER_SIZE + bodySize);
+		}
+	}
+
+	const char* expected[6] = { "[should be 0 1]", "[should be 0 0]",
+		"[should be 0 1 C:/dir1/dir11]", "[should be 0 0 and 9 dirs, 21 files]",
+		"[should be 1 0]", "[should be 1 0]" };
+
+	for (unsigned int i = 0; i < bodies.size(); i++)
+	{
+		FSFrameReader reader(bodies[i].data(), bodies[i].size());
+		std::uint8_t status = 0;
+		std::uint32_t result = 0;
+		std::string text;
+
+		reader.readU8(status);
+		reader.readU32(result);
+		reader.readText(text);
+
+		// Keep multi-line payloads on one line
+		for (char& c : text)
+		{
+			c = (c == '\n') ? ' ' : c;
+		}
+
+		std::cout << "Response " << i + 1 << ": " << static_cast<int>(status) << " "
+			<< result << " " << text << " " << expected[i] << std::endl;
+	}
+
+	close(fd);
+	server.stop();
+	serverThread.join();
+
+	std::cout << "Requests executed: " << server.getRequestCount()
+		<< " [should be 6]" << std::endl;
+}
+
+void FSTSnapshotTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING SAVESNAPSHOT() AND OPENSNAPSHOT() **" << std::endl
+		<< std::endl;
+
+	const std::string fileName = "FSTSnapshotTest.fsi";
+	std::ostringstream original;
+	std::ostringstream reopened;
+	FilesystemTree tree;
+
+	treePtr->displayTree(original);
+	std::cout << "Save the tree: " << treePtr->saveSnapshot(fileName)
+		<< " [should be 1]" << std::endl;
+
+	tree.openSnapshot(fileName);
+	std::cout << "Hydration right after opening:" << std::endl;
+	tree.displayHydrationStats(std::cout);
+
+	tree.displayTree(reopened);
+	std::cout << "Reopened tree matches: " << (original.str() == reopened.str())
+		<< " [should be 1]" << std::endl;
+
+	// Change the reopened tree and save it over the file it was opened from
+	std::cout << "Create file23 in " << ROOT_NAME << "/dir1/dir2/dir6: "
+		<< tree.create("file23", FILE_TYPE, ROOT_NAME + "/dir1/dir2/dir6")
+		<< " [should be 1]" << std::endl;
+	std::cout << "Save over the open snapshot: " << tree.saveSnapshot(fileName)
+		<< " [should be 1]" << std::endl;
+
+	FilesystemTree saved;
+	saved.openSnapshot(fileName);
+	std::cout << "Searching for file23 in the saved snapshot:" << std::endl;
+	std::cout << saved.find("file23", ROOT_NAME, std::cout) << " matches found. [should be 1]"
+		<< std::endl;
+
+	// A name too long for the format is refused before the file is touched
+	std::cout << "Create a 70000 character file in " << ROOT_NAME << ": "
+		<< saved.create(std::string(70000, 'a'), FILE_TYPE, ROOT_NAME)
+		<< " [should be 1]" << std::endl;
+	std::cout << "Save with the long name: " << saved.saveSnapshot(fileName)
+		<< " [should be 0]" << std::endl;
+
+	std::cout << std::endl << "** SAVED SNAPSHOT STATS **" << std::endl
+		<< std::endl << "Should be 8 directories, 22 files:" << std::endl;
+	FilesystemTree unchanged;
+	unchanged.openSnapshot(fileName);
+	unchanged.displayStats(std::cout);
+
+	std::remove(fileName.c_str());
+}
+
+void FSTParallelCopyTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING COPY() OF A LARGE SUBTREE **" << std::endl
+		<< std::endl;
+
+	// 64 directories of 100 files each: large enough to be copied in parallel
+	// on a machine with several cores
+	FilesystemTree tree(*treePtr);
+
+	tree.create("dir11", DIR_TYPE, ROOT_NAME);
+	for (int i = 0; i < 64; i++)
+	{
+		std::string dirName = "sub" + std::to_string(i);
+
+		tree.create(dirName, DIR_TYPE, ROOT_NAME + "/dir11");
+		for (int j = 0; j < 100; j++)
+		{
+			tree.create("file" + std::to_string(j), FILE_TYPE,
+				ROOT_NAME + "/dir11/" + dirName);
+		}
+	}
+
+	std::cout << "Copy dir11 from " << ROOT_NAME << " to " << ROOT_NAME
+		<< "/dir1/dir2/dir6: "
+		<< tree.copy("dir11", ROOT_NAME, ROOT_NAME + "/dir1/dir2/dir6")
+		<< " [should be 1]" << std::endl;
+
+	std::ostringstream found;
+	std::cout << "Searching for file99 starting at " << ROOT_NAME
+		<< "/dir1/dir2/dir6/dir11: "
+		<< tree.find("file99", ROOT_NAME + "/dir1/dir2/dir6/dir11", found)
+		<< " matches found. [should be 64]" << std::endl;
+
+	std::cout << "Remove sub0 from the original: "
+		<< tree.remove("sub0", ROOT_NAME + "/dir11")
+		<< " [should be 1]" << std::endl;
+	std::cout << "Searching for sub0 starting at " << ROOT_NAME << ":" << std::endl;
+	std::cout << tree.find("sub0", ROOT_NAME, std::cout) << " matches found. [should be 1]"
+		<< std::endl;
+
+	// The copy constructor copies the whole tree the same way
+	FilesystemTree treeCopy(tree);
+
+	std::cout << std::endl << "** COPIED TREE STATS **" << std::endl
+		<< std::endl << "Should be 137 directories, 12721 files:" << std::endl;
+	treeCopy.displayStats(std::cout);
+}
+
+void FSTListTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING LIST() **" << std::endl << std::endl;
+
+	FilesystemTree tree(*treePtr);
+	FSListPage page;
+	int pageNumber = 0;
+	const char* expected[3] = { "[should be dir2 dir7, more 1]",
+		"[should be file3 file4, more 1]", "[should be file5, more 0]" };
+
+	// Two entries per page, with the cursor's own entry removed after the
+	// first page
+	std::cout << "Pages of 2 in " << ROOT_NAME << "/dir1:" << std::endl;
+	do
+	{
+		page = tree.list(ROOT_NAME + "/dir1", "", page.cursor, 2);
+
+		std::cout << "Page " << pageNumber + 1 << ":";
+		for (const std::string& name : page.names)
+		{
+			std::cout << " " << name;
+		}
+		std::cout << ", more " << page.hasMore << " " << expected[pageNumber] << std::endl;
+
+		if (pageNumber == 0)
+		{
+			std::cout << "Remove dir7 from " << ROOT_NAME << "/dir1: "
+				<< tree.remove("dir7", ROOT_NAME + "/dir1") << " [should be 1]" << std::endl;
+		}
+		pageNumber++;
+	} while (page.hasMore && pageNumber < 3);
+
+	page = tree.list(ROOT_NAME + "/dir1", "file", "", 10);
+	std::cout << "Names starting with file in " << ROOT_NAME << "/dir1: "
+		<< page.names.size() << " [should be 3]" << std::endl;
+
+	page = tree.list(ROOT_NAME + "/dir1", "dir", "", 10);
+	std::cout << "Names starting with dir in " << ROOT_NAME << "/dir1: "
+		<< page.names.size() << " [should be 1]" << std::endl;
+
+	page = tree.list(ROOT_NAME + "/dir1/file3", "", "", 10);
+	std::cout << "Listing the file " << ROOT_NAME << "/dir1/file3: "
+		<< page.names.size() << " [should be 0]" << std::endl;
+}
+
+void FSTPolicyTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING THE BUILD POLICIES **" << std::endl << std::endl;
+
+	// The expected results depend on the -D options this was built with
+	FilesystemTree tree(*treePtr);
+	std::ostringstream found;
+
+	std::cout << "Name policy: " << FSNamePolicy::NAME << ", folds case "
+		<< FSNamePolicy::FOLDS_CASE << ", children " << FSChildPolicy::NAME
+		<< ", threads " << FS_USE_THREADS << std::endl;
+
+	std::cout << "Create Dir-12 in " << ROOT_NAME << ": "
+		<< tree.create("Dir-12", DIR_TYPE, ROOT_NAME)
+		<< " [should be 1]" << std::endl;
+	std::cout << "Searching for Dir12 starting at " << ROOT_NAME << ": "
+		<< tree.find("Dir12", ROOT_NAME, found)
+		<< " matches found. [should be 1]" << std::endl;
+	std::cout << "Searching for dir12 starting at " << ROOT_NAME << ": "
+		<< tree.find("dir12", ROOT_NAME, found) << " matches found. [should be "
+		<< FSNamePolicy::FOLDS_CASE << "]" << std::endl;
+	std::cout << "Create DIR12 in " << ROOT_NAME << ": "
+		<< tree.create("DIR12", DIR_TYPE, ROOT_NAME)
+		<< " [should be " << !FSNamePolicy::FOLDS_CASE << "]" << std::endl;
+	std::cout << "Create file24 in " << ROOT_NAME << "/dir12: "
+		<< tree.create("file24", FILE_TYPE, ROOT_NAME + "/dir12")
+		<< " [should be " << FSNamePolicy::FOLDS_CASE << "]" << std::endl;
+
+	// Grow a directory past any inline child slots, then shrink it back
+	std::string names;
+	for (int i = 5; i >= 0; i--)
+	{
+		tree.create("entry" + std::to_string(i), FILE_TYPE, ROOT_NAME + "/Dir12");
+	}
+	for (const std::string& name : tree.list(ROOT_NAME + "/Dir12", "", "", 10).names)
+	{
+		names += " " + name;
+	}
+	std::cout << "Entries of " << ROOT_NAME << "/Dir12:" << names
+		<< " [should be entry0 to entry5 in order]" << std::endl;
+
+	for (int i = 1; i < 6; i++)
+	{
+		tree.remove("entry" + std::to_string(i), ROOT_NAME + "/Dir12");
+	}
+	tree.shrink(ROOT_NAME + "/Dir12");
+	std::cout << "Searching for entry0 starting at " << ROOT_NAME << ":" << std::endl;
+	std::cout << tree.find("entry0", ROOT_NAME, std::cout) << " matches found. [should be 1]"
+		<< std::endl;
+}
+
+void FSTExportTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING EXPORTTREE() **" << std::endl << std::endl;
+
+	FilesystemTree tree(*treePtr);
+
+	std::cout << "JSON export of " << ROOT_NAME << "/dir1/dir2/dir6:" << std::endl;
+	std::cout << tree.exportTree(ROOT_NAME + "/dir1/dir2/dir6", EXPORT_JSON, std::cout)
+		<< " [should be 1 after an object with file13, file14 and file15]" << std::endl;
+	std::cout << "NDJSON export of " << ROOT_NAME << "/dir1/dir7:" << std::endl;
+	std::cout << tree.exportTree(ROOT_NAME + "/dir1/dir7", EXPORT_NDJSON, std::cout)
+		<< " [should be 1 after 4 lines]" << std::endl;
+	std::cout << "CSV export of " << ROOT_NAME << "/dir1/dir7:" << std::endl;
+	std::cout << tree.exportTree(ROOT_NAME + "/dir1/dir7", EXPORT_CSV, std::cout)
+		<< " [should be 1 after a header and 4 rows]" << std::endl;
+
+	// A large tree is serialized in chunks, which must still come out
+	// whole and in order
+	std::ostringstream large;
+	std::ostringstream copied;
+	std::string line;
+	std::string lastPath;
+	int lines = 0;
+	bool ordered = true;
+
+	for (int i = 0; i < 20000; i++)
+	{
+		tree.create("big" + std::to_string(i), FILE_TYPE, ROOT_NAME + "/dir1/dir2/dir6");
+	}
+	tree.exportTree(ROOT_NAME, EXPORT_CSV, large);
+
+	std::istringstream rows(large.str());
+	std::getline(rows, line); // header
+	while (std::getline(rows, line))
+	{
+		std::string path = line.substr(0, line.find(','));
+
+		ordered = ordered && (lastPath.empty() || lastPath < path);
+		lastPath = path;
+		lines++;
+	}
+	std::cout << "Rows in a large export: " << lines << " [should be 20030]" << std::endl;
+	std::cout << "Rows in preorder: " << ordered << " [should be 1]" << std::endl;
+
+	FilesystemTree treeCopy(tree);
+	treeCopy.exportTree(ROOT_NAME, EXPORT_CSV, copied);
+	std::cout << "Export of a copy matches: " << (large.str() == copied.str())
+		<< " [should be 1]" << std::endl;
+
+	std::ostringstream unused;
+	std::cout << "Export of " << ROOT_NAME << "/dir99: "
+		<< tree.exportTree(ROOT_NAME + "/dir99", EXPORT_JSON, unused)
+		<< " [should be 0]" << std::endl;
+	std::cout << "Export in format 7: "
+		<< tree.exportTree(ROOT_NAME, 7, unused)
+		<< " [should be 0]" << std::endl;
+}
+
+void FSTWatchTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING WATCH() **" << std::endl << std::endl;
+
+	FilesystemTree tree(*treePtr);
+	std::vector<FSEvent> dir1Events;
+	std::vector<FSEvent> dir7Events;
+	std::shared_ptr<FSEventQueue> rootQueue = std::make_shared<FSEventQueue>(2);
+
+	int dir1Id = tree.watch(ROOT_NAME + "/dir1", true,
+		[&dir1Events](const FSEvent& event) { dir1Events.push_back(event); });
+	int dir7Id = tree.watch(ROOT_NAME + "/dir1/dir7", false,
+		[&dir7Events](const FSEvent& event) { dir7Events.push_back(event); });
+	int rootId = tree.watch(ROOT_NAME, false, rootQueue);
+
+	std::cout << "Watch " << ROOT_NAME << "/dir99: "
+		<< tree.watch(ROOT_NAME + "/dir99", false, rootQueue) << " [should be -1]"
+		<< std::endl;
+
+	tree.create("file23", FILE_TYPE, ROOT_NAME + "/dir1/dir7");
+	tree.create("file24", FILE_TYPE, ROOT_NAME);
+	tree.move("file23", ROOT_NAME + "/dir1/dir7", ROOT_NAME);
+	tree.copy("file1", ROOT_NAME, ROOT_NAME + "/dir1");
+	tree.create("file25", FILE_TYPE, ROOT_NAME); // the root queue is full by now
+
+	std::cout << "Events below " << ROOT_NAME << "/dir1: " << dir1Events.size()
+		<< " [should be 3]" << std::endl;
+	std::cout << "Events in " << ROOT_NAME << "/dir1/dir7: " << dir7Events.size()
+		<< " [should be 2]" << std::endl;
+	if (dir7Events.size() == 2)
+	{
+		std::cout << "Second one: kind " << dir7Events[1].kind << " " << dir7Events[1].name
+			<< " from " << dir7Events[1].path << " to " << dir7Events[1].destPath
+			<< " [should be kind 2 file23 from C:/dir1/dir7 to C:]" << std::endl;
+	}
+
+	FSEvent event;
+	int popped = 0;
+	while (rootQueue->pop(event))
+	{
+		popped++;
+	}
+	std::cout << "Events queued for " << ROOT_NAME << ": " << popped
+		<< " [should be 2]" << std::endl;
+	std::cout << "Overflow flagged: " << rootQueue->takeOverflow()
+		<< ", dropped " << rootQueue->getDroppedCount() << " [should be 1, dropped 1]"
+		<< std::endl;
+
+	std::cout << "Unwatch " << ROOT_NAME << "/dir1/dir7: " << tree.unwatch(dir7Id)
+		<< " [should be 1]" << std::endl;
+	std::cout << "Unwatch it again: " << tree.unwatch(dir7Id) << " [should be 0]"
+		<< std::endl;
+	tree.remove("file16", ROOT_NAME + "/dir1/dir7");
+	tree.format();
+
+	std::cout << "Events in " << ROOT_NAME << "/dir1/dir7 after unwatch: "
+		<< dir7Events.size() << " [should be 2]" << std::endl;
+	std::cout << "Events below " << ROOT_NAME << "/dir1: " << dir1Events.size()
+		<< ", last kind " << dir1Events.back().kind << " [should be 5, last kind 4]"
+		<< std::endl;
+
+	tree.unwatch(dir1Id);
+	tree.unwatch(rootId);
+
+	// A move between two watched directories reaches each watcher once
+	int recursiveEvents = 0;
+	int rootEvents = 0;
+	tree.watch(ROOT_NAME, true, [&recursiveEvents](const FSEvent&) { recursiveEvents++; });
+	tree.watch(ROOT_NAME, false, [&rootEvents](const FSEvent&) { rootEvents++; });
+	tree.create("dir1", DIR_TYPE, ROOT_NAME);
+	tree.create("dir2", DIR_TYPE, ROOT_NAME + "/dir1");
+	tree.create("file26", FILE_TYPE, ROOT_NAME + "/dir1/dir2");
+	tree.watch(ROOT_NAME + "/dir1", true, [&recursiveEvents](const FSEvent&) { recursiveEvents++; });
+	tree.move("file26", ROOT_NAME + "/dir1/dir2", ROOT_NAME);
+	tree.move("file26", ROOT_NAME, ROOT_NAME + "/dir1");
+
+	std::cout << "Events for the recursive watchers: " << recursiveEvents
+		<< " [should be 7]" << std::endl;
+	std::cout << "Events for " << ROOT_NAME << ": " << rootEvents << " [should be 3]"
+		<< std::endl;
+
+	// Other forms of a path reach the same watchers and events carry clean names
+	std::vector<FSEvent> dirEvents;
+	tree.watch(ROOT_NAME + "/dir1", false,
+		[&dirEvents](const FSEvent& event) { dirEvents.push_back(event); });
+	tree.create("zz1", FILE_TYPE, ROOT_NAME + "x/dir1");
+	tree.remove("zz1", ROOT_NAME + "y/dir1/");
+
+	std::cout << "Events for the recursive watchers: " << recursiveEvents
+		<< " [should be 11]" << std::endl;
+	std::cout << "Events in " << ROOT_NAME << "x/dir1: " << dirEvents.size()
+		<< " [should be 2]" << std::endl;
+	if (dirEvents.size() == 2)
+	{
+		std::cout << "Removed " << dirEvents[1].name << " from " << dirEvents[1].path
+			<< " [should be zz1 from C:/dir1]" << std::endl;
+	}
+
+	// An event identical to one still queued is merged into it
+	std::shared_ptr<FSEventQueue> formatQueue = std::make_shared<FSEventQueue>(4);
+	tree.watch(ROOT_NAME, false, formatQueue);
+	tree.format();
+	tree.format();
+	popped = 0;
+	while (formatQueue->pop(event))
+	{
+		popped++;
+	}
+	tree.format();
+	std::cout << "Formats queued: " << popped << ", coalesced "
+		<< formatQueue->getCoalescedCount() << ", queued after a pop "
+		<< formatQueue->pop(event) << " [should be 1, coalesced 1, queued after a pop 1]"
+		<< std::endl;
+}
+
+void FSTFilterFindTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING FIND() WITH SUBTREE FILTERS **" << std::endl
+		<< std::endl;
+
+	FilesystemTree tree(*treePtr);
+	std::ostringstream found;
+
+	// Filters must never hide a match, whatever has changed since they were
+	// built
+	std::cout << "Searching for file22 starting at " << ROOT_NAME << ": "
+		<< tree.find("file22", ROOT_NAME, found) << " matches found. [should be 4]"
+		<< std::endl;
+	std::cout << "Remove file22 from " << ROOT_NAME << "/dir1/dir7: "
+		<< tree.remove("file22", ROOT_NAME + "/dir1/dir7") << " [should be 1]" << std::endl;
+	std::cout << "Move dir8 from " << ROOT_NAME << "/dir1/dir2/dir8/dir2 to " << ROOT_NAME
+		<< ": " << tree.move("dir8", ROOT_NAME + "/dir1/dir2/dir8/dir2", ROOT_NAME)
+		<< " [should be 1]" << std::endl;
+	std::cout << "Searching for file22 starting at " << ROOT_NAME << ": "
+		<< tree.find("file22", ROOT_NAME, found) << " matches found. [should be 3]"
+		<< std::endl;
+	std::cout << "Searching for file18 starting at " << ROOT_NAME << "/dir8: "
+		<< tree.find("file18", ROOT_NAME + "/dir8", found) << " matches found. [should be 1]"
+		<< std::endl;
+	tree.refreshFilters();
+	std::cout << "Searching for file22 after refreshFilters(): "
+		<< tree.find("file22", ROOT_NAME, found) << " matches found. [should be 3]"
+		<< std::endl;
+	std::cout << "Searching for file99 starting at " << ROOT_NAME << ": "
+		<< tree.find("file99", ROOT_NAME, found) << " matches found. [should be 0]"
+		<< std::endl;
+
+	// Text between ROOT_NAME and the first separator is ignored, so these
+	// paths name C:/dir1 and C:/dir1/dir2
+	std::cout << "Create file26 in " << ROOT_NAME << "x/dir1: "
+		<< tree.create("file26", FILE_TYPE, ROOT_NAME + "x/dir1") << " [should be 1]"
+		<< std::endl;
+	std::cout << "Searching for file26 starting at " << ROOT_NAME << ": "
+		<< tree.find("file26", ROOT_NAME, found) << " matches found. [should be 1]"
+		<< std::endl;
+	std::cout << "Move dir1 from " << ROOT_NAME << " to " << ROOT_NAME << "q/dir1/dir2: "
+		<< tree.move("dir1", ROOT_NAME, ROOT_NAME + "q/dir1/dir2") << " [should be 0]"
+		<< std::endl;
+
+	std::cout << std::endl << "** FILTER STATS **" << std::endl << std::endl;
+	tree.displayFilterStats(std::cout);
+}
+
+void FSTTraceTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING STARTTRACE() AND STOPTRACE() **" << std::endl
+		<< std::endl;
+
+	const std::string fileName = "FSTTraceTest.fstrace";
+	FilesystemTree tree(*treePtr);
+	FilesystemTree replayed(*treePtr);
+	std::ostringstream found;
+
+	tree.startTrace(fileName);
+	tree.create("dir11", DIR_TYPE, ROOT_NAME);
+	tree.create("file23", FILE_TYPE, ROOT_NAME + "/dir11");
+	tree.copy("dir11", ROOT_NAME, ROOT_NAME + "/dir1");
+	tree.find("file23", ROOT_NAME, found);
+	tree.remove("file1", ROOT_NAME);
+	tree.remove("file1", ROOT_NAME);
+	tree.list(ROOT_NAME, "", "", 10);
+	tree.create(std::string(70000, 'a'), FILE_TYPE, ROOT_NAME); // recorded in full
+	std::cout << "Calls recorded: " << tree.stopTrace() << " [should be 8]"
+		<< std::endl;
+
+	std::vector<FSTraceRecord> records = readTrace(fileName);
+	int mismatches = 0;
+
+	std::cout << "Calls read back: " << records.size() << " [should be 8]" << std::endl;
+
+	// Re-run the trace on the starting tree, the way the replay tool does
+	for (const FSTraceRecord& record : records)
+	{
+		std::uint32_t result = 0;
+
+		switch (record.op)
+		{
+		case TRACE_CREATE:
+			result = replayed.create(record.name, record.number, record.path);
+			break;
+		case TRACE_REMOVE:
+			result = replayed.remove(record.name, record.path);
+			break;
+		case TRACE_COPY:
+			result = replayed.copy(record.name, record.path, record.destPath);
+			break;
+		case TRACE_FIND:
+			result = replayed.find(record.name, record.path, found);
+			break;
+		case TRACE_LIST:
+			result = replayed.list(record.path, record.name, record.destPath,
+				record.number).names.size();
+			break;
+		}
+
+		mismatches += (result != record.result);
+	}
+
+	std::cout << "Results that differ on replay: " << mismatches << " [should be 0]"
+		<< std::endl;
+	if (records.size() > 5)
+	{
+		std::cout << "Op of call 6: " << traceOpName(records[5].op) << ", result "
+			<< records[5].result << " [should be remove, result 0]" << std::endl;
+	}
+	if (records.size() > 7)
+	{
+		std::cout << "Name length of call 8: " << records[7].name.length()
+			<< " [should be 70000]" << std::endl;
+	}
+
+	std::remove(fileName.c_str());
+}
+
+void FSTMemoryTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING MEMORYUSAGE() AND SHRINK() **" << std::endl
+		<< std::endl;
+
+	FilesystemTree tree(*treePtr);
+
+	std::cout << "Nodes counted from " << ROOT_NAME << ": " << tree.memoryUsage().nodes
+		<< " [should be 30]" << std::endl;
+	std::cout << "Nodes counted from " << ROOT_NAME << "/dir1/dir7: "
+		<< tree.memoryUsage(ROOT_NAME + "/dir1/dir7").nodes << " [should be 4]" << std::endl;
+	std::cout << "Bytes counted for " << ROOT_NAME << "/dir99: "
+		<< tree.memoryUsage(ROOT_NAME + "/dir99").total() << " [should be 0]" << std::endl;
+
+	// Growing a directory and emptying it again leaves slack behind
+	for (int i = 0; i < 1000; i++)
+	{
+		tree.create("big" + std::to_string(i), FILE_TYPE, ROOT_NAME + "/dir1/dir2/dir6");
+	}
+	for (int i = 0; i < 1000; i++)
+	{
+		tree.remove("big" + std::to_string(i), ROOT_NAME + "/dir1/dir2/dir6");
+	}
+
+	FSMemoryUsage before = tree.memoryUsage();
+	std::size_t freed = tree.shrink();
+	FSMemoryUsage after = tree.memoryUsage();
+
+	std::cout << "Child slack before shrink() is over 7000 bytes: "
+		<< (before.childSlack > 7000) << " [should be 1]" << std::endl;
+	std::cout << "Child slack after shrink(): " << after.childSlack << " [should be 0]"
+		<< std::endl;
+	std::cout << "Bytes freed match the change in total: "
+		<< (freed == before.total() - after.total()) << " [should be 1]" << std::endl;
+
+	// A snapshot's mapping is reported apart from the heap
+	const std::string fileName = "FSTMemoryTest.fsi";
+	FilesystemTree opened;
+
+	tree.saveSnapshot(fileName);
+	opened.openSnapshot(fileName);
+	FSMemoryUsage usage = opened.memoryUsage();
+	std::size_t heap = usage.nodeHeaders + usage.names + usage.childArrays
+		+ usage.indexes + usage.caches + usage.arenaSlack;
+	std::cout << "Snapshot mapping counted: " << (usage.mapped > 0)
+		<< ", total is the heap alone: " << (usage.total() == heap)
+		<< " [should be 1, total is the heap alone: 1]" << std::endl;
+
+	std::remove(fileName.c_str());
+}
+
+void FSTShardedTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING SHARDEDFILESYSTEMTREE **" << std::endl << std::endl;
+
+	// Rebuild the tree in 4 shards from its CSV export, parents first
+	ShardedFilesystemTree sharded(4);
+	std::ostringstream exported;
+	std::string line;
+
+	treePtr->exportTree(ROOT_NAME, EXPORT_CSV, exported);
+	std::istringstream rows(exported.str());
+	std::getline(rows, line); // header
+	std::getline(rows, line); // ROOT_NAME itself
+	while (std::getline(rows, line))
+	{
+		std::size_t nameStart = line.find(',') + 1;
+		std::size_t typeStart = line.find(',', nameStart) + 1;
+		std::string path = line.substr(0, nameStart - 1);
+
+		sharded.create(line.substr(nameStart, typeStart - nameStart - 1),
+			(line.substr(typeStart) == "directory") ? DIR_TYPE : FILE_TYPE,
+			path.substr(0, path.rfind(SEPARATING_CHAR)));
+	}
+
+	std::cout << "** SHARDED TREE STATS **" << std::endl << std::endl
+		<< "Should be 8 directories, 21 files:" << std::endl;
+	sharded.displayStats(std::cout);
+
+	std::ostringstream found;
+	std::cout << std::endl << "Searching for file22 starting at " << ROOT_NAME << ": "
+		<< sharded.find("file22", ROOT_NAME, found) << " matches found. [should be 4]"
+		<< std::endl;
+	std::cout << "Searching for file22 starting at " << ROOT_NAME << "/dir1: "
+		<< sharded.find("file22", ROOT_NAME + "/dir1", found)
+		<< " matches found. [should be 3]" << std::endl;
+
+	// Every spelling of a path reaches the shard holding it
+	std::cout << "Shard of " << ROOT_NAME << "x/dir1 is the shard of " << ROOT_NAME
+		<< "/dir1: " << (sharded.shardOf(ROOT_NAME + "x/dir1") == sharded.shardOf(ROOT_NAME
+		+ "/dir1")) << " [should be 1]" << std::endl;
+	std::cout << "Create file26 in " << ROOT_NAME << "x/dir1: "
+		<< sharded.create("file26", FILE_TYPE, ROOT_NAME + "x/dir1") << " [should be 1]"
+		<< std::endl;
+	std::cout << "Shard of " << ROOT_NAME << ": " << sharded.shardOf(ROOT_NAME)
+		<< " [should be -1]" << std::endl;
+
+	// Top-level entries usually sit in different shards
+	std::cout << "Create dir11 to dir14 in " << ROOT_NAME << ": ";
+	for (int i = 11; i <= 14; i++)
+	{
+		std::cout << sharded.create("dir" + std::to_string(i), DIR_TYPE, ROOT_NAME);
+	}
+	std::cout << " [should be 1111]" << std::endl;
+	std::cout << "Move dir1 from " << ROOT_NAME << " to " << ROOT_NAME << "/dir11: "
+		<< sharded.move("dir1", ROOT_NAME, ROOT_NAME + "/dir11") << " [should be 1]"
+		<< std::endl;
+	std::cout << "Copy dir11 from " << ROOT_NAME << " to " << ROOT_NAME << "/dir12: "
+		<< sharded.copy("dir11", ROOT_NAME, ROOT_NAME + "/dir12") << " [should be 1]"
+		<< std::endl;
+	std::cout << "Move dir12 from " << ROOT_NAME << " to " << ROOT_NAME << "q/dir12/dir11: "
+		<< sharded.move("dir12", ROOT_NAME, ROOT_NAME + "q/dir12/dir11") << " [should be 0]"
+		<< std::endl;
+	std::cout << "Searching for file26 starting at " << ROOT_NAME << ":" << std::endl;
+	std::cout << sharded.find("file26", ROOT_NAME, std::cout) << " matches found. [should be 2]"
+		<< std::endl;
+
+	std::cout << std::endl << "** SHARDED TREE STATS **" << std::endl << std::endl
+		<< "Should be 21 directories, 41 files:" << std::endl;
+	sharded.displayStats(std::cout);
+
+	std::cout << "Format: " << sharded.format() << " [should be 1]" << std::endl
+		<< "Should be 0 directories, 0 files:" << std::endl;
+	sharded.displayStats(std::cout);
+}
+
+void FSTCompactTest(std::shared_ptr<FilesystemTree> treePtr)
+{
+	std::cout << std::endl << "** TESTING COMPACT() AND COMPACTSTEP() **" << std::endl
+		<< std::endl;
+
+	FilesystemTree tree(*treePtr);
+	FilesystemTree reference(*treePtr);
+	std::ostringstream before;
+	std::ostringstream after;
+
+	tree.displayTree(before);
+	tree.compact();
+	tree.displayTree(after);
+	std::cout << "Tree unchanged by compact(): " << (before.str() == after.str())
+		<< " [should be 1]" << std::endl;
+	std::cout << "Nodes counted after compact(): " << tree.memoryUsage().nodes
+		<< " [should be 30]" << std::endl;
+
+	// Slices of 3 nodes, with the tree changed between them, including the
+	// directory being walked
+	int slices = 1;
+	bool done = tree.compactStep(3);
+
+	tree.remove("dir1", ROOT_NAME);
+	reference.remove("dir1", ROOT_NAME);
+	tree.create("dir11", DIR_TYPE, ROOT_NAME);
+	reference.create("dir11", DIR_TYPE, ROOT_NAME);
+	while (!done)
+	{
+		done = tree.compactStep(3);
+		tree.create("file" + std::to_string(100 + slices), FILE_TYPE, ROOT_NAME + "/dir11");
+		reference.create("file" + std::to_string(100 + slices), FILE_TYPE,
+			ROOT_NAME + "/dir11");
+		slices++;
+	}
+
+	before.str("");
+	after.str("");
+	tree.displayTree(before);
+	reference.displayTree(after);
+	std::cout << "Tree matches the same changes without compaction: "
+		<< (before.str() == after.str()) << " [should be 1]" << std::endl;
+	std::cout << "Slices: " << slices << " [should be 3]" << std::endl;
+
+	// Blocks are given back as the nodes in them go
+	for (int i = 0; i < 20000; i++)
+	{
+		tree.create("big" + std::to_string(i), FILE_TYPE, ROOT_NAME + "/dir11");
+	}
+	tree.compact();
+	std::cout << "Remove dir11 from " << ROOT_NAME << ": " << tree.remove("dir11", ROOT_NAME)
+		<< " [should be 1]" << std::endl;
+	tree.compact();
+	std::cout << "Arena slack under 1 MB: " << (tree.memoryUsage().arenaSlack < (1 << 20))
+		<< " [should be 1]" << std::endl;
+	std::cout << "Searching for file2 starting at " << ROOT_NAME << ":" << std::endl;
+	std::cout << tree.find("file2", ROOT_NAME, std::cout) << " matches found. [should be 1]"
+		<< std::endl;
+}
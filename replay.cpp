@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FSNode.h"
+#include "FilesystemTree.h"
+#include "FSTrace.h"
+
+// Usage: replay <traceFile> [startFile] [threads]
+//
+// Re-runs a trace recorded with FilesystemTree::startTrace(). The tree
+// starts from startFile, which may be a snapshot or an input text file
+// ("-" or none for an empty tree), and must be the state the traced tree
+// was in when the trace started. With several threads each thread replays
+// the whole trace against its own copy of the starting tree. Reports per-op
+// latency percentiles next to the recorded median, and any calls whose
+// result differs from the recorded one.
+
+typedef std::chrono::steady_clock Clock;
+
+/*
+* DiscardBuffer swallows output so find(), exportTree() and the display
+* calls succeed without the sink costing anything.
+*/
+class DiscardBuffer : public std::streambuf
+{
+protected:
+	int_type overflow(int_type c) override
+	{
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char*, std::streamsize count) override
+	{
+		return count;
+	}
+};
+
+// Latencies in nanoseconds and result mismatches, per op
+struct ReplayStats
+{
+	std::vector<std::uint64_t> latencies[TRACE_OP_COUNT];
+	std::size_t mismatches[TRACE_OP_COUNT] = {};
+};
+
+/*
+* loadStart() fills tree from startFile: a snapshot if it is one, otherwise
+* an input text file.
+*/
+void loadStart(FilesystemTree& tree, const std::string& startFile)
+{
+	if (startFile.empty() || startFile == "-")
+	{
+		return;
+	}
+
+	try
+	{
+		tree.openSnapshot(startFile);
+	}
+	catch (const std::runtime_error&)
+	{
+		tree = FilesystemTree(startFile);
+	}
+}
+
+/*
+* replayRecord() repeats one traced call.
+*
+* @return The call's result encoded as in the trace.
+*/
+std::uint32_t replayRecord(FilesystemTree& tree, const FSTraceRecord& record,
+	std::ostream& out)
+{
+	std::uint32_t result = 0;
+
+	switch (record.op)
+	{
+	case TRACE_CREATE:
+		result = tree.create(record.name, record.number, record.path);
+		break;
+	case TRACE_REMOVE:
+		result = tree.remove(record.name, record.path);
+		break;
+	case TRACE_MOVE:
+		result = tree.move(record.name, record.path, record.destPath);
+		break;
+	case TRACE_COPY:
+		result = tree.copy(record.name, record.path, record.destPath);
+		break;
+	case TRACE_FIND:
+		result = tree.find(record.name, record.path, out);
+		break;
+	case TRACE_LIST:
+		result = tree.list(record.path, record.name, record.destPath,
+			record.number).names.size();
+		break;
+	case TRACE_EXPORT:
+		result = tree.exportTree(record.path, record.number, out);
+		break;
+	case TRACE_DISPLAY:
+		tree.displayTree(out);
+		break;
+	case TRACE_STATS:
+		tree.displayStats(out);
+		break;
+	case TRACE_FORMAT:
+		result = tree.format();
+		break;
+	}
+
+	return result;
+}
+
+void runReplay(FilesystemTree* treePtr, const std::vector<FSTraceRecord>* records,
+	ReplayStats* stats)
+{
+	DiscardBuffer buffer;
+	std::ostream out(&buffer);
+
+	for (const FSTraceRecord& record : *records)
+	{
+		Clock::time_point start = Clock::now();
+		std::uint32_t result = replayRecord(*treePtr, record, out);
+		std::uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			Clock::now() - start).count();
+
+		stats->latencies[record.op].push_back(elapsed);
+		stats->mismatches[record.op] += (result != record.result);
+	}
+}
+
+/*
+* percentile() returns the value at fraction p of the sorted samples.
+*/
+double percentile(const std::vector<std::uint64_t>& sorted, double p)
+{
+	if (sorted.empty())
+	{
+		return 0.0;
+	}
+
+	std::size_t index = static_cast<std::size_t>(p * (sorted.size() - 1));
+	return sorted[index] / 1000.0; // microseconds
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <traceFile> [startFile] [threads]"
+			<< std::endl;
+		return 1;
+	}
+
+	try
+	{
+		std::vector<FSTraceRecord> records = readTrace(argv[1]);
+		std::string startFile = (argc > 2) ? argv[2] : "";
+		int threadCount = (argc > 3) ? std::max(1, std::stoi(argv[3])) : 1;
+
+		// Every thread gets its own tree, loaded before the clock starts
+		FilesystemTree startTree;
+		loadStart(startTree, startFile);
+
+		std::vector<std::unique_ptr<FilesystemTree>> trees;
+		std::vector<ReplayStats> stats(threadCount);
+		std::vector<std::thread> threads;
+
+		for (int i = 0; i < threadCount; i++)
+		{
+			trees.emplace_back(new FilesystemTree(startTree));
+		}
+
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < threadCount; i++)
+		{
+			threads.emplace_back(runReplay, trees[i].get(), &records, &stats[i]);
+		}
+		for (std::thread& t : threads)
+		{
+			t.join();
+		}
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::cout << "Replayed " << records.size() << " calls on " << threadCount
+			<< " thread(s) in " << std::fixed << std::setprecision(3) << elapsed
+			<< " s (" << std::setprecision(0)
+			<< records.size() * threadCount / std::max(elapsed, 1e-9)
+			<< " calls/s)" << std::endl;
+		std::cout << "op           calls  rec p50(us)    p50(us)    p99(us)"
+			<< "  p99.9(us)    max(us)  mismatches" << std::endl;
+
+		for (std::uint8_t op = 1; op < TRACE_OP_COUNT; op++)
+		{
+			std::vector<std::uint64_t> recorded;
+			std::vector<std::uint64_t> all;
+			std::size_t mismatches = 0;
+
+			for (const FSTraceRecord& record : records)
+			{
+				if (record.op == op)
+				{
+					recorded.push_back(record.elapsedNanos);
+				}
+			}
+			for (const ReplayStats& threadStats : stats)
+			{
+				all.insert(all.end(), threadStats.latencies[op].begin(),
+					threadStats.latencies[op].end());
+				mismatches += threadStats.mismatches[op];
+			}
+
+			if (all.empty())
+			{
+				continue;
+			}
+
+			std::sort(recorded.begin(), recorded.end());
+			std::sort(all.begin(), all.end());
+
+			std::cout << std::left << std::setw(8) << traceOpName(op) << std::right
+				<< std::setw(10) << all.size()
+				<< std::setprecision(1)
+				<< std::setw(13) << percentile(recorded, 0.50)
+				<< std::setw(11) << percentile(all, 0.50)
+				<< std::setw(11) << percentile(all, 0.99)
+				<< std::setw(11) << percentile(all, 0.999)
+				<< std::setw(11) << all.back() / 1000.0
+				<< std::setw(12) << mismatches << std::endl;
+		}
+	}
+	catch (const std::runtime_error& error)
+	{
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}